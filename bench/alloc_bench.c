@@ -0,0 +1,252 @@
+#define STB_DS_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "disk.h"
+#include "fat12.h"
+#include "io_batch.h"
+#include "readahead.h"
+#include "sector_cache.h"
+#include "stb_ds.h"
+
+// Allocation policy benchmark.
+// Replays the same create/delete churn under every policy of fat12_allocate_extents() on a copy of an image,
+// then reports how fragmented the files and the free space ended up and how fast the surviving files export.
+//
+// usage: alloc_bench [image] [operations] [seed]
+//
+// The churn only touches the FAT in memory; the export pass reads the files' clusters from a scratch copy of
+// the image with O_DIRECT (buffered if refused), so the numbers reflect the layout and not the page cache.
+
+#define BENCH_DEFAULT_IMAGE "imgs/backups/fat12subdir.img"
+#define BENCH_DEFAULT_OPERATIONS 4000
+#define BENCH_DIRECTORIES 8        // One cluster directories created along the churn, every file picks one as its parent
+#define BENCH_TARGET_USAGE 0.75    // Above this share of used clusters the churn only deletes
+#define BENCH_EXPORT_PASSES 20     // Export passes over every live file, timed together
+
+typedef struct {
+    uint16_t first_cluster;
+    uint16_t parent;
+    uint32_t clusters;
+} bench_file_t;
+
+typedef struct {
+    uint32_t files;
+    uint32_t fragmented;    // Files in more than one run
+    uint32_t runs;          // Runs over all files, the minimum number of reads an export needs
+    uint32_t free_runs;     // Runs of free clusters
+    uint32_t largest_free;  // Largest free run, in clusters
+    double parent_distance; // Average clusters between a file and its parent directory
+    uint32_t failed;        // Creations that found no room
+    double export_mib_s;
+} bench_result_t;
+
+static uint64_t rng_state;
+
+static uint32_t bench_random(void) {
+    // xorshift64*, the same sequence for every policy
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+// Mostly small files, some medium, a few large ones
+static uint32_t bench_file_size(void) {
+    uint32_t kind = bench_random() % 100;
+    if (kind < 70) return 1 + bench_random() % 8;
+    if (kind < 95) return 9 + bench_random() % 56;
+    return 65 + bench_random() % 192;
+}
+
+static bool bench_create(bench_file_t **files, uint16_t parent, uint32_t clusters) {
+    fat12_extent_s *runs = NULL;
+    if (!fat12_allocate_extents(clusters, parent, &runs)) {
+        arrfree(runs);
+        return false;
+    }
+
+    uint16_t previous = 0;
+    for (int i = 0; i < arrlen(runs); i++) {
+        for (uint16_t c = runs[i].start; c < runs[i].start + runs[i].length; c++) {
+            if (previous != 0) fat12_set_table_entry(previous, c);
+            previous = c;
+        }
+    }
+    fat12_set_table_entry(previous, FAT12_EOC_END);
+
+    bench_file_t file = {.first_cluster = runs[0].start, .parent = parent, .clusters = clusters};
+    arrpush(*files, file);
+    arrfree(runs);
+    return true;
+}
+
+static void bench_delete(bench_file_t **files, size_t which) {
+    uint16_t *chain = NULL;
+    fat12_get_table_entry_chain((*files)[which].first_cluster, &chain);
+    for (int i = 0; i < arrlen(chain); i++) {
+        fat12_set_table_entry(chain[i], FAT12_FREE);
+    }
+    arrfree(chain);
+    arrdelswap(*files, which);
+}
+
+static double bench_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static double bench_export(disk_t *disk, const bench_file_t *files) {
+    uint64_t bytes = 0;
+    double start = bench_seconds();
+
+    for (int pass = 0; pass < BENCH_EXPORT_PASSES; pass++) {
+        for (int i = 0; i < arrlen(files); i++) {
+            uint16_t *chain = NULL;
+            fat12_get_table_entry_chain(files[i].first_cluster, &chain);
+
+            ra_stream_t stream;
+            if (ra_open(&stream, disk, chain, arrlen(chain))) {
+                for (int c = 0; c < arrlen(chain); c++) {
+                    if (ra_read_cluster(&stream, c) == NULL) break;
+                    bytes += SECTOR_SIZE;
+                }
+                ra_close(&stream);
+            }
+            arrfree(chain);
+        }
+    }
+
+    double elapsed = bench_seconds() - start;
+    return elapsed > 0 ? bytes / elapsed / (1024.0 * 1024.0) : 0.0;
+}
+
+static bool bench_copy_image(const char *source, char *scratch_path) {
+    FILE *in = fopen(source, "rb");
+    if (in == NULL) {
+        perror("Erro ao abrir a imagem");
+        return false;
+    }
+
+    int fd = mkstemp(scratch_path);
+    FILE *out = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (out == NULL) {
+        perror("Erro ao criar a copia da imagem");
+        fclose(in);
+        return false;
+    }
+
+    char buffer[64 * 1024];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        fwrite(buffer, 1, n, out);
+    }
+    fclose(in);
+    fclose(out);
+    return true;
+}
+
+static bench_result_t bench_run(const char *image, const char *scratch, fat12_alloc_policy_e policy,
+                                uint32_t operations, uint64_t seed) {
+    bench_result_t result = {0};
+    rng_state = seed;
+
+    disk_t *memory = disk_open_memory(image);
+    if (memory == NULL) {
+        perror("Erro ao carregar a imagem");
+        exit(EXIT_FAILURE);
+    }
+    fat12_load_full_fat_table(memory);
+    fat12_set_allocation_policy(policy);
+
+    bench_file_t *directories = NULL;
+    bench_create(&directories, FAT12_DATA_AREA_NUMBER_OFFSET, 1);
+
+    bench_file_t *files = NULL;
+    uint32_t data_clusters = fat12_count_data_clusters();
+    uint32_t directory_every = operations / BENCH_DIRECTORIES + 1;
+    for (uint32_t op = 0; op < operations; op++) {
+        // Directories appear over time, so each lands wherever the policy finds room at that point
+        if (op > 0 && op % directory_every == 0) {
+            bench_create(&directories, directories[bench_random() % arrlen(directories)].first_cluster, 1);
+        }
+
+        uint32_t size = bench_file_size();
+        uint16_t parent = directories[bench_random() % arrlen(directories)].first_cluster;
+        uint32_t choice = bench_random() % 100;
+
+        double usage = 1.0 - (double)fat12_count_free_clusters() / data_clusters;
+        bool delete = arrlen(files) > 0 && (usage > BENCH_TARGET_USAGE || choice < 45);
+        if (delete) {
+            bench_delete(&files, bench_random() % arrlen(files));
+        } else if (!bench_create(&files, parent, size)) {
+            result.failed++;
+        }
+    }
+
+    result.files = arrlen(files);
+    uint64_t distance = 0;
+    for (int i = 0; i < arrlen(files); i++) {
+        const fat12_extent_s *extents;
+        size_t count = 0;
+        fat12_get_chain_extents(files[i].first_cluster, &extents, &count);
+        result.runs += count;
+        result.fragmented += count > 1;
+        distance += abs((int)files[i].first_cluster - (int)files[i].parent);
+    }
+    result.parent_distance = result.files ? (double)distance / result.files : 0.0;
+
+    size_t free_count = 0;
+    const fat12_extent_s *free_runs = fat12_free_extents(&free_count);
+    result.free_runs = free_count;
+    for (size_t i = 0; i < free_count; i++) {
+        if (free_runs[i].length > result.largest_free) result.largest_free = free_runs[i].length;
+    }
+
+    // The FAT stays the churned one in memory, only the data clusters are read from the scratch copy
+    disk_t *device = disk_open_file(scratch, true);
+    if (device == NULL) device = disk_open_file(scratch, false);
+    if (device != NULL) {
+        result.export_mib_s = bench_export(device, files);
+        disk_close(device);
+    }
+
+    arrfree(files);
+    arrfree(directories);
+    disk_close(memory);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const char *image = argc > 1 ? argv[1] : BENCH_DEFAULT_IMAGE;
+    uint32_t operations = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : BENCH_DEFAULT_OPERATIONS;
+    uint64_t seed = argc > 3 ? strtoull(argv[3], NULL, 10) : 0x5EED;
+    if (seed == 0) seed = 1;  // xorshift never leaves 0
+
+    char scratch[] = "/tmp/alloc_bench_XXXXXX";
+    if (!bench_copy_image(image, scratch)) return EXIT_FAILURE;
+
+    iob_init(false, IOB_DEFAULT_QUEUE_DEPTH);
+    sc_init(0);  // No sector cache, every export read reaches the device
+
+    printf("Imagem: %s, %u operacoes, semente %llu\n\n", image, operations, (unsigned long long)seed);
+    printf("%-16s %8s %8s %12s %8s %10s %12s %12s %8s %10s\n", "Politica", "Arquivos", "Runs", "Fragmentados",
+           "Livres", "Maior livre", "Dist. pai", "Runs/arquivo", "Falhas", "MiB/s");
+
+    for (int policy = 0; policy < FAT12_ALLOC_POLICY_COUNT; policy++) {
+        bench_result_t r = bench_run(image, scratch, policy, operations, seed);
+        printf("%-16s %8u %8u %11.1f%% %8u %10u %12.1f %12.2f %8u %10.1f\n",
+               fat12_allocation_policy_name(policy), r.files, r.runs,
+               r.files ? 100.0 * r.fragmented / r.files : 0.0, r.free_runs, r.largest_free, r.parent_distance,
+               r.files ? (double)r.runs / r.files : 0.0, r.failed, r.export_mib_s);
+    }
+
+    sc_destroy();
+    iob_destroy();
+    unlink(scratch);
+    return EXIT_SUCCESS;
+}
@@ -5,21 +5,46 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "block_device.h"
 #include "buffer_operation.h"
 #include "cli_menu.h"
+#include "cluster_owner.h"
 #include "defines.h"
+#include "disk.h"
 #include "fat12.h"
 #include "file_system.h"
+#include "flat_tree.h"
+#include "io_batch.h"
+#include "readahead.h"
+#include "sector_cache.h"
+
+#define APP_MAX_REPORTED_MISMATCHES 32  // FAT entries listed by the copy check, the rest is only counted
+#define APP_MAX_PATH_LENGTH 512         // Paths printed by du and find, deeper ones are cut
+
+// How the disk image is accessed once mounted
+typedef enum {
+    APP_IO_MODE_PREAD,     // Positional reads and writes on the image file (default)
+    APP_IO_MODE_MMAP,      // Whole image mapped into memory
+    APP_IO_MODE_IO_URING,  // Like APP_IO_MODE_PREAD, batched transfers go through io_uring
+    APP_IO_MODE_DIRECT,    // Like APP_IO_MODE_PREAD, bypassing the page cache with O_DIRECT aligned transfers
+    APP_IO_MODE_MEMORY,    // Image copied into memory at mount, nothing is written back
+} app_io_mode_e;
 
 // Returns true if a disk image is currently mounted
 bool app_is_mounted(void);
 
 // menu callbacks
+void app_io_mode_callback(Menu *m);
 void app_mount_callback(Menu *m);
 void app_unmount_callback(Menu *m);
 void app_boot_sector_callback(Menu *m);
+void app_io_stats_callback(Menu *m);
 void app_ls1_callback(Menu *m);
 void app_ls_callback(Menu *m);
+void app_df_callback(Menu *m);
+void app_du_callback(Menu *m);
+void app_find_callback(Menu *m, const char *input);
+void app_verify_fat_callback(Menu *m);
 void app_rm_callback(Menu *m, const char *input);
 void app_debug1_callback(Menu *m);
 void app_debug2_callback(Menu *m);
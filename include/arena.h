@@ -0,0 +1,35 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bump allocator over a list of large blocks.
+// Allocations are never freed one by one: everything goes away together with arena_release(), which costs one
+// free() per block. Meant for structures that are built up piece by piece and dropped as a whole.
+
+#define ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16  // Enough for any type the file system stores
+
+struct arena_block;
+
+typedef struct {
+    struct arena_block *head;  // Block allocations are currently carved from, linked to the older ones
+    size_t block_size;         // Size of a regular block, larger requests get a block of their own
+    uint64_t allocations;      // arena_alloc() calls served
+    uint64_t blocks;           // Blocks obtained from malloc()
+    uint64_t bytes_used;       // Bytes handed out, padding included
+    uint64_t bytes_reserved;   // Bytes obtained from malloc()
+} arena_t;
+
+// Sets up an empty arena, no memory is taken until the first allocation. 0 selects ARENA_DEFAULT_BLOCK_SIZE.
+void arena_init(arena_t *arena, size_t block_size);
+// Returns size bytes aligned to ARENA_ALIGNMENT, valid until arena_release(). Exits when memory runs out.
+void *arena_alloc(arena_t *arena, size_t size);
+// Same as arena_alloc() with the memory zeroed.
+void *arena_calloc(arena_t *arena, size_t size);
+// Frees every block and leaves the arena empty and ready for reuse.
+void arena_release(arena_t *arena);
+
+#endif  // ARENA_H
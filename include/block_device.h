@@ -0,0 +1,41 @@
+#ifndef BLOCK_DEVICE_H
+#define BLOCK_DEVICE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "defines.h"
+
+// Sector addressed block layer on top of positional I/O (pread/pwrite).
+// No file offset or buffer is kept between calls, so the same descriptor can be shared
+// by several callers (and later threads) without any seek coordination.
+
+// O_DIRECT support. Transfers on a direct descriptor are widened to whole BD_DIRECT_ALIGNMENT blocks
+// and staged through a small process-wide pool of aligned bounce buffers. The pool and the set of direct
+// descriptors are claimed and updated with atomics, so direct transfers may also run from several threads.
+#define BD_DIRECT_ALIGNMENT 4096
+#define BD_DIRECT_SECTORS_PER_BLOCK (BD_DIRECT_ALIGNMENT / SECTOR_SIZE)
+#define BD_DIRECT_POOL_BUFFERS 4
+#define BD_DIRECT_POOL_BUFFER_SIZE (64 * 1024)
+#define BD_MAX_DIRECT_FD 1024
+
+// Opens a device or image for O_DIRECT read/write and registers the descriptor as direct.
+// Returns -1 with errno set when the platform or the filesystem (e.g. tmpfs) does not accept O_DIRECT, or with
+// EINVAL when the size is not a multiple of BD_DIRECT_ALIGNMENT. Writes past the size taken here fail with EIO.
+int bd_open_direct(const char *path);
+// Forgets that fd was direct, must be called before the descriptor is closed.
+void bd_release_direct(int fd);
+bool bd_is_direct(int fd);
+// Number of sectors the device transfers at once anyway: a whole aligned block for direct descriptors, 1 otherwise.
+uint32_t bd_transfer_granularity(int fd);
+
+// Reads `count` consecutive sectors starting at `first_sector` into buffer.
+bool bd_read_sectors(int fd, void *buffer, uint32_t first_sector, uint32_t count);
+// Writes `count` consecutive sectors starting at `first_sector` from buffer.
+bool bd_write_sectors(int fd, const void *buffer, uint32_t first_sector, uint32_t count);
+
+// Writes `count` consecutive sectors starting at `first_sector`, gathering them from separate sector sized buffers.
+// Used to write a run of scattered in-memory sectors with a single pwritev.
+bool bd_writev_sectors(int fd, const uint8_t *const *sectors, uint32_t first_sector, uint32_t count);
+
+#endif  // BLOCK_DEVICE_H
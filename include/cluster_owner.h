@@ -0,0 +1,41 @@
+#ifndef CLUSTER_OWNER_H
+#define CLUSTER_OWNER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "disk.h"
+#include "fat12.h"
+
+// Reverse map from data cluster to the directory entry that owns it.
+// Built once at mount by walking every directory, then kept up to date by the file system layer:
+// co_assign() when a new entry is linked to its chain, co_release() before a chain is freed.
+// Lets removal find the entry to clear without scanning the parent directory, and answers
+// "which file owns this cluster / sector" in O(1).
+
+typedef struct {
+    fat12_dir_entry_s dirent;  // Where the owning entry lives: cluster 0 is the root directory
+    uint16_t first_cluster;    // First cluster of the owning chain
+    uint16_t file_index;       // Position of the cluster inside that chain
+} co_owner_s;
+
+// Rebuilds the map from the directories on disk. Needs the FAT table loaded.
+void co_build(disk_t *disk);
+// Forgets every owner, used on unmount.
+void co_reset(void);
+bool co_is_built(void);
+
+// Records the chain starting at first_cluster as owned by dirent. Clusters that already belong to
+// another entry keep their first owner and are counted as cross-links.
+void co_assign(fat12_dir_entry_s dirent, uint16_t first_cluster);
+// Forgets the owners of the chain starting at first_cluster. Call it while the chain is still linked.
+void co_release(uint16_t first_cluster);
+
+// Returns false when the cluster has no known owner.
+bool co_lookup_cluster(uint16_t cluster, co_owner_s *owner);
+// Same as co_lookup_cluster() for an absolute sector of the data area.
+bool co_lookup_sector(uint32_t sector, co_owner_s *owner);
+// Clusters claimed by more than one directory entry since the last build.
+uint32_t co_count_cross_links(void);
+
+#endif  // CLUSTER_OWNER_H
@@ -0,0 +1,78 @@
+#ifndef DISK_H
+#define DISK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "defines.h"
+
+// Backend the FAT12 layer reads and writes the volume through.
+// Every backend implements the basic operations of disk_ops_t; the optional ones are fast paths
+// (zero-copy views, batched reads, prefetch, kernel hints) and disk.c falls back to the basic ones when they are NULL.
+//
+// Backends shipped:
+//  - file:   pread/pwrite on the image through the sector cache and batch engine, optionally O_DIRECT
+//  - mmap:   whole image mapped shared, stores reach the image file
+//  - memory: image copied into the heap at open, changes are dropped at close (benchmarks, tests)
+
+typedef struct disk disk_t;
+
+typedef struct {
+    void *buffer;
+    uint32_t first_sector;
+    uint32_t count;
+} disk_run_t;
+
+typedef struct {
+    const char *name;
+
+    bool (*read_sectors)(disk_t *disk, void *buffer, uint32_t first_sector, uint32_t count);
+    bool (*write_sectors)(disk_t *disk, const void *buffer, uint32_t first_sector, uint32_t count);
+    bool (*flush)(disk_t *disk);
+    uint64_t (*size)(disk_t *disk);  // In bytes
+    void (*close)(disk_t *disk);     // Releases the backend context, pending writes must be flushed first
+
+    // Optional
+    const uint8_t *(*view_sector)(disk_t *disk, uint32_t sector);            // Read-only pointer valid until the next view
+    bool (*read_runs)(disk_t *disk, const disk_run_t *runs, size_t n);      // Several reads submitted together
+    bool (*prefetch)(disk_t *disk, const uint32_t *sectors, size_t n);      // Warm the backend's own cache
+    bool (*advise)(disk_t *disk, uint32_t first_sector, uint32_t count);   // Hint a read in the near future
+} disk_ops_t;
+
+struct disk {
+    const disk_ops_t *ops;
+    void *context;  // Backend private state
+};
+
+// Opens an image for positional I/O on its descriptor. With direct set the image is opened with O_DIRECT
+// and NULL is returned (errno set) when the platform or filesystem refuses it.
+disk_t *disk_open_file(const char *path, bool direct);
+// Maps the whole image into memory. Not available on Windows.
+disk_t *disk_open_mmap(const char *path);
+// Loads the whole image into the heap. Writes only change the copy in memory.
+disk_t *disk_open_memory(const char *path);
+// Wraps a backend implemented elsewhere.
+disk_t *disk_create(const disk_ops_t *ops, void *context);
+// Releases the backend and the handle. Does not flush.
+void disk_close(disk_t *disk);
+
+const char *disk_name(const disk_t *disk);
+bool disk_read_sectors(disk_t *disk, void *buffer, uint32_t first_sector, uint32_t count);
+bool disk_write_sectors(disk_t *disk, const void *buffer, uint32_t first_sector, uint32_t count);
+// Pushes every pending write of the backend to the image.
+bool disk_flush(disk_t *disk);
+uint64_t disk_size(disk_t *disk);
+
+// Returns a read-only pointer to a sector, or NULL on error.
+// WARNING: Only valid until the next view or write on the same disk.
+const uint8_t *disk_view_sector(disk_t *disk, uint32_t sector);
+bool disk_read_runs(disk_t *disk, const disk_run_t *runs, size_t n);
+// Writes several runs as one request. The file backend stages them in the sector cache, so they leave
+// together in the next flush's batch; the in-memory backends copy them straight away.
+bool disk_write_runs(disk_t *disk, const disk_run_t *runs, size_t n);
+bool disk_prefetch(disk_t *disk, const uint32_t *sectors, size_t n);
+// Returns false when the backend has nothing to warm up.
+bool disk_advise(disk_t *disk, uint32_t first_sector, uint32_t count);
+
+#endif  // DISK_H
@@ -9,13 +9,16 @@
 #include <string.h>
 
 #include "defines.h"
+#include "disk.h"
 
 #define FAT12_FAT_TABLES_START 1               // FAT12 starts at sector 1
 #define FAT12_NUM_OF_FAT_TABLES_SECTORS 9      // FAT12 can have up to 9 sectors for the FAT table
 #define FAT12_FAT_TABLES_RESERVED_ENTRIES 2    // FAT12 reserves the first two entries in the FAT table
+#define FAT12_MAX_FAT_COPIES 4                 // Upper bound accepted for the boot sector's num_of_fats
 #define FAT12_DIRECTORY_ENTRIES_PER_SECTOR 16  // Maximum number of entries 512 / 32 = 16 entries per sector
 
 #define FAT12_NUM_OF_FAT_TABLES_ENTRIES (((SECTOR_SIZE * FAT12_NUM_OF_FAT_TABLES_SECTORS) / 3) + FAT12_FAT_TABLES_RESERVED_ENTRIES)  // Each FAT12 entry is 1.5 bytes, so we divide by 3
+#define FAT12_FAT_TABLE_ENTRY_CAPACITY ((SECTOR_SIZE * FAT12_NUM_OF_FAT_TABLES_SECTORS * 2) / 3)  // Entries the 9 FAT sectors can encode (3072)
 
 #define FAT12_FILE_NAME_LENGTH 8       // Maximum length of a file name in FAT12
 #define FAT12_FILE_EXTENSION_LENGTH 3  // Maximum length of a file extension in FAT12
@@ -38,6 +41,10 @@
 #define FAT12_EOC_BEGIN (0xFF8)       // End of cluster chain marker
 #define FAT12_EOC_END (0xFFF)         // End of cluster chain marker
 
+// First byte of a directory entry's name
+#define FAT12_ENTRY_END 0x00      // This entry and every one after it are unused, parsing stops here
+#define FAT12_ENTRY_DELETED 0xE5  // Removed entry, skipped, the slot can be reused
+
 // Packed para que o compilador não adicione padding entre os campos da estrutura
 typedef struct __attribute__((__packed__)) {
     uint8_t ignore0[11];               // Ignored bytes
@@ -105,14 +112,57 @@ typedef struct {
     uint8_t idx;
 } fat12_dir_entry_s;
 
+// Run of consecutive clusters inside a cluster chain
+typedef struct {
+    uint16_t start;   // First cluster of the run
+    uint16_t length;  // Number of clusters in the run
+} fat12_extent_s;
+
+typedef struct {
+    uint64_t hits;           // Chain lookups answered from the cache
+    uint64_t misses;         // Chain lookups that walked the FAT
+    uint64_t invalidations;  // Cached chains dropped because a member entry changed
+    uint64_t chains;         // Chains currently cached
+} fat12_chain_cache_stats_s;
+
+// How fat12_allocate_extents() places a file. First-fit fills the free runs in address order; the others take
+// a single free run that holds the whole file when there is one and otherwise spread the file over several runs,
+// chosen by the same rule.
+typedef enum {
+    FAT12_ALLOC_FIRST_FIT,        // Lowest free clusters first, any run size (the original cluster-by-cluster layout)
+    FAT12_ALLOC_NEXT_FIT,         // First run that fits, from where the previous allocation ended, wrapping around
+    FAT12_ALLOC_BEST_FIT,         // Smallest run that fits; otherwise largest runs first, fewest fragments (default)
+    FAT12_ALLOC_PARENT_LOCALITY,  // Run nearest to the hint (parent directory), from the side facing it
+    FAT12_ALLOC_POLICY_COUNT,
+} fat12_alloc_policy_e;
+
+// Entry where a FAT copy disagrees with FAT #1
+typedef struct {
+    uint8_t copy;       // 1 is FAT #2
+    uint16_t entry;     // Entry index
+    uint16_t expected;  // Value in FAT #1
+    uint16_t found;     // Value in this copy
+} fat12_fat_mismatch_s;
+
 fat12_time_s fat12_extract_time(uint16_t time);
 fat12_date_s fat12_extract_date(uint16_t date);
 
-fat12_boot_sector_s fat12_read_boot_sector(FILE *disk);
-fat12_file_subdir_s fat12_read_directory_entry(FILE *disk, uint16_t entry_idx);
-fat12_file_subdir_s fat12_read_directory_from_data_area(FILE *disk, uint16_t cluster, uint8_t idx);
+fat12_boot_sector_s fat12_read_boot_sector(disk_t *disk);
+fat12_file_subdir_s fat12_read_directory_entry(disk_t *disk, uint16_t entry_idx);
+fat12_file_subdir_s fat12_read_directory_from_data_area(disk_t *disk, uint16_t cluster, uint8_t idx);
+
+// Zero-copy variants of the directory readers.
+// WARNING: The pointer may refer to a shared sector buffer (see disk_view_sector()) and is only valid until the next view call.
+const fat12_file_subdir_s *fat12_view_directory_entry(disk_t *disk, uint16_t entry_idx);
+const fat12_file_subdir_s *fat12_view_directory_from_data_area(disk_t *disk, uint16_t cluster, uint8_t idx);
+// Reads all FAT12_ROOT_DIRECTORY_ENTRIES root entries with a single read into entries.
+bool fat12_read_root_directory(disk_t *disk, fat12_file_subdir_s *entries);
+// The FAT12_DIRECTORY_ENTRIES_PER_SECTOR entries of a directory cluster, same lifetime rules as the views above.
+const fat12_file_subdir_s *fat12_view_directory_cluster(disk_t *disk, uint16_t cluster);
+// Returns the entry marked as deleted (FAT12_ENTRY_DELETED), the way removal leaves it in the directory.
+fat12_file_subdir_s fat12_deleted_entry(fat12_file_subdir_s entry);
 bool fat12_write_directory(
-    FILE *disk,
+    disk_t *disk,
     uint16_t cluster,
     uint8_t idx,
     fat12_file_subdir_s entry);
@@ -120,25 +170,93 @@ bool fat12_write_directory(
 // Allocate a directory entry in the root directory or in a subdirectory
 // If the cluster is 0, it will allocate in the root directory.
 // Returns the cluster number and of the allocated entry.
-fat12_dir_entry_s fat12_allocate_entry_in_directory(FILE *disk, uint16_t cluster);
+fat12_dir_entry_s fat12_allocate_entry_in_directory(disk_t *disk, uint16_t cluster);
 
 void fat12_print_boot_sector_info(fat12_boot_sector_s bs);
 void fat12_print_directory_info(fat12_file_subdir_s dir);
 
-uint8_t *fat12_read_data_sector(FILE *disk, uint8_t *buffer, uint16_t sector_number);
-bool fat12_write_data_sector(FILE *disk, uint8_t *buffer, uint16_t sector_number);
+uint8_t *fat12_read_data_sector(disk_t *disk, uint8_t *buffer, uint16_t sector_number);
+// Zero-copy variant of fat12_read_data_sector(), same lifetime rules as the directory views. Returns NULL on error.
+const uint8_t *fat12_view_data_sector(disk_t *disk, uint16_t sector_number);
+bool fat12_write_data_sector(disk_t *disk, uint8_t *buffer, uint16_t sector_number);
+
+// Writes count consecutive data clusters starting at first_cluster in a single transfer.
+bool fat12_write_data_clusters(disk_t *disk, const uint8_t *buffer, uint16_t first_cluster, uint16_t count);
+// Groups a cluster chain into runs of consecutive clusters.
+// WARNING: The extents array must be freed after use (arrfree()).
+void fat12_chain_to_extents(const uint16_t *chain, size_t chain_length, fat12_extent_s **extents);
+// Reads every cluster of a chain into buffer (chain_length * SECTOR_SIZE bytes), one transfer per contiguous run.
+bool fat12_read_cluster_chain(disk_t *disk, const uint16_t *chain, size_t chain_length, uint8_t *buffer);
+// Loads the given data clusters into the backend's cache with a single batched submission,
+// so the reads that follow are served from memory. No-op for backends without a cache.
+bool fat12_prefetch_clusters(disk_t *disk, const uint16_t *clusters, size_t count);
+// Hints the backend that the given data clusters will be read soon (posix_fadvise or madvise WILLNEED),
+// so it can start fetching them in the background. Returns the number of extents advised.
+size_t fat12_advise_clusters(disk_t *disk, const uint16_t *clusters, size_t count);
+
+// Loads FAT #1 and reads num_of_fats from the boot sector: every write after this updates all FAT copies.
+uint8_t *fat12_load_full_fat_table(disk_t *disk);
+bool fat12_write_full_fat_table(disk_t *disk);
+// Writes back only the FAT sectors changed by fat12_set_table_entry() since the last flush or load,
+// to the same sectors of every FAT copy in one request.
+bool fat12_flush_fat_table(disk_t *disk);
+
+// Metadata transactions. Between begin and commit, fat12_write_directory() edits a staged copy of the
+// directory sector (the views see it) and fat12_flush_fat_table() writes nothing. The outermost commit
+// writes the dirty FAT sectors, then the staged directory sectors in disk order, coalescing consecutive
+// sectors into one write. Abort restores the FAT entries as they were at begin and drops the staged sectors.
+// A commit that fails rolls the in-memory state back like abort, then writes the old contents of every
+// directory sector it may have written and of the FAT sectors it touched. If those writes fail too, the image
+// is left partly written and the FAT sectors stay dirty for the next flush.
+// Transactions nest: inner begin/commit pairs join the outer one. An inner abort rolls everything back
+// and makes the outermost commit roll back again and return false.
+void fat12_begin_transaction(void);
+bool fat12_commit_transaction(disk_t *disk);
+void fat12_abort_transaction(void);
+bool fat12_in_transaction(void);
 
-uint8_t *fat12_load_full_fat_table(FILE *disk);
-bool fat12_write_full_fat_table(FILE *disk);
+// Number of FAT copies kept in step, 1 until a table is loaded.
+uint8_t fat12_count_fat_copies(void);
+// Compares the first `copies` FAT copies on the image against FAT #1 and appends every entry that differs.
+// Identical copies are settled with a single memcmp; only diverging ones are decoded entry by entry.
+// WARNING: The mismatches array must be freed after use (arrfree()).
+bool fat12_verify_fat_copies(disk_t *disk, uint8_t copies, fat12_fat_mismatch_s **mismatches);
 
 uint16_t fat12_get_table_entry(uint16_t entry_idx);
 bool fat12_set_table_entry(uint16_t entry_idx, uint16_t value);
 
+// Returns the first free data cluster at or after start_idx, or 0 when there is none. Uses the free cluster map, no FAT scan.
 uint16_t fat12_find_next_free_entry(uint16_t start_idx);
+// Free data clusters, kept up to date by fat12_set_table_entry().
+uint32_t fat12_count_free_clusters(void);
+// Runs of free data clusters ordered by start cluster, kept in step with fat12_set_table_entry().
+// WARNING: The array is owned by the FAT module and only valid until the next FAT change.
+const fat12_extent_s *fat12_free_extents(size_t *count);
+// Picks free runs for a file of the given number of clusters under the current allocation policy and appends them
+// to runs in disk order. hint is the cluster the file should be close to (its parent directory's first cluster),
+// only parent-locality uses it. Nothing is marked used, the caller links the clusters with fat12_set_table_entry().
+// Returns false when space is short.
+// WARNING: The runs array must be freed after use (arrfree()).
+bool fat12_allocate_extents(uint32_t clusters, uint16_t hint, fat12_extent_s **runs);
+void fat12_set_allocation_policy(fat12_alloc_policy_e policy);
+fat12_alloc_policy_e fat12_get_allocation_policy(void);
+const char *fat12_allocation_policy_name(fat12_alloc_policy_e policy);
+// Data clusters the allocator hands out.
+uint32_t fat12_count_data_clusters(void);
 
 // Reads a FAT12 table entry and returns the cluster chain starting from the first cluster.
+// Chains are cached as runs keyed by their first cluster; fat12_set_table_entry() on a member drops the cached copy.
 // WARNING: The chain must be freed after use.
 bool fat12_get_table_entry_chain(uint16_t first_entry, uint16_t **chain);
+// The cached chain as runs of consecutive clusters.
+// WARNING: The array is owned by the cache and only valid until the next FAT change.
+bool fat12_get_chain_extents(uint16_t first_entry, const fat12_extent_s **extents, size_t *count);
+// Number of clusters in the chain, 0 if the chain is broken.
+uint32_t fat12_get_chain_length(uint16_t first_entry);
+// Cluster at position n of the chain (0 is first_entry), found with a binary search over the cached runs.
+// Returns 0 when n is past the end or the chain is broken.
+uint16_t fat12_get_nth_cluster(uint16_t first_entry, uint32_t n);
+fat12_chain_cache_stats_s fat12_get_chain_cache_stats(void);
 
 char *fat12_attribute_to_string(uint8_t attribute);
 
@@ -0,0 +1,30 @@
+#ifndef FAT12_CODEC_H
+#define FAT12_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bulk conversion between the packed 12-bit FAT layout and one uint16_t per entry.
+// Every 3 packed bytes hold a pair of entries:
+//   even = byte0 | (byte1 & 0x0F) << 8
+//   odd  = byte1 >> 4 | byte2 << 4
+// On x86 the widest of AVX2 (16 entries per step) and SSSE3 (8 entries per step) the CPU supports
+// is picked on first use; everything else runs the scalar loop.
+
+typedef enum {
+    F12C_IMPL_SCALAR,
+    F12C_IMPL_SSSE3,
+    F12C_IMPL_AVX2,
+} f12c_impl_e;
+
+// Decodes `pairs` entry pairs: reads pairs * 3 bytes, writes pairs * 2 entries.
+void f12c_unpack(const uint8_t *packed, uint16_t *entries, size_t pairs);
+// Encodes `pairs` entry pairs: reads pairs * 2 entries (only the low 12 bits are kept), writes pairs * 3 bytes.
+void f12c_pack(const uint16_t *entries, uint8_t *packed, size_t pairs);
+
+// Forces an implementation, for benchmarks and cross checks. Returns false if the CPU does not support it.
+bool f12c_select(f12c_impl_e impl);
+const char *f12c_implementation_name(void);
+
+#endif  // FAT12_CODEC_H
@@ -8,13 +8,11 @@
 #include "fat12_helpers.h"
 
 #define FS_MAX_DIRECTORY_DEPTH 32                                                              // Maximum depth of the directory tree
+#define FS_WRITE_CHUNK_CLUSTERS 64                                                             // Clusters written per transfer when importing a file
+#define FS_TREE_ARENA_BLOCK_SIZE (32 * 1024)                                                   // Arena block of a directory tree, a few hundred nodes
+#define FS_TREE_MIN_CHILDREN 8                                                                 // First children array of a directory
 #define FS_MAX_FILENAME_LENGTH (FAT12_FILE_NAME_LENGTH + 1 + FAT12_FILE_EXTENSION_LENGTH + 1)  // Maximum length of a file name +2 for the dot and null terminator
 
-typedef struct {
-    fat12_file_subdir_s *files;    // Array of files in the directory
-    fat12_file_subdir_s *subdirs;  // Array of subdirectories in the directory
-} fs_directory_t;
-
 typedef enum {
     FS_DIRECTORY_TYPE_FILE,    // Represents a file
     FS_DIRECTORY_TYPE_SUBDIR,  // Represents a subdirectory
@@ -26,51 +24,93 @@ typedef struct {
 } fs_fat_compatible_filename_t;
 
 struct fs_directory_tree_node;
+typedef struct fs_directory_tree fs_directory_tree_t;  // Memory owned by a whole tree
 
 typedef struct fs_directory_tree_node {
     struct fs_directory_tree_node *parent;     // Pointer to the parent node in the directory tree
-    struct fs_directory_tree_node **children;  // Array of subdirectory nodes (using stb_ds dynamic arrays)
+    struct fs_directory_tree_node **children;  // Array of child nodes, allocated from the tree's arena
+    size_t children_count;                     // Number of entries in children
+    size_t children_capacity;                  // Room in children before it has to be reallocated
+    struct fs_directory_tree_node **child_slots;  // Same children indexed by packed 8.3 name (hash table)
+    size_t child_slots_capacity;                  // Power of two, at least twice children_count
+    fs_directory_tree_t *tree;                 // Tree the node belongs to
     fs_directory_type_e type;                  // Type of the directory (file or subdirectory)
     fat12_file_subdir_s metadata;              // Directory or File information
     size_t depth;                              // Depth in the directory tree node
+    bool children_loaded;                      // Children were read from disk, always true for files
 } fs_directory_tree_node_t;
 
 void fs_print_ls_directory_header();
 
 void fs_print_file_leaf(fat12_file_subdir_s dir, uint8_t depth);
 
-// Reads the root directory of the FAT12 file system and returns a pointer to a fs_directory_t structure
-// WARNING: The returned pointer must be freed after use to avoid memory leaks (arrfree()).
-fs_directory_t fs_read_root_directory(FILE *disk);
-fs_directory_t fs_read_directory(FILE *disk, uint16_t cluster);
-
-// Creates a disk tree structure from the FAT12 file system
-// This function reads the root directory and builds a tree structure of directories and files.
+// Returns just the root node, directories are read the first time a lookup or fs_load_children() reaches them.
 // WARNING: The returned pointer must be freed after use to avoid memory leaks (fs_free_disk_tree()).
-fs_directory_tree_node_t *fs_create_disk_tree(FILE *disk);
-// Finds a node in the directory tree by its path.
+fs_directory_tree_node_t *fs_open_disk_tree(void);
+// Reads the entries of a directory node into its children, once. Returns false if the directory can not be read,
+// in which case the node is left empty and unloaded so the next call tries again.
+bool fs_load_children(disk_t *disk, fs_directory_tree_node_t *dir);
+// Returns the child of a loaded directory node with the given name ("NAME.EXT", ".", ".."), or NULL.
+fs_directory_tree_node_t *fs_find_child(fs_directory_tree_node_t *dir, const char *name);
+// Loads every directory below dir that is not loaded yet. Returns false at the first directory that can not be read.
+bool fs_load_subtree(disk_t *disk, fs_directory_tree_node_t *dir);
+
+// The directory tree of the mounted volume, kept across operations (a dentry cache).
+// Directories are read once, fs_add_file_to_directory() and fs_remove_file_or_directory() update the tree in place.
+// Nodes stay valid until they are removed or the cache is reset, which an aborted transaction also does.
+fs_directory_tree_node_t *fs_get_dentry_cache(void);
+// Frees the cached tree, the next fs_get_dentry_cache() starts from the root again. Used on mount and unmount.
+void fs_reset_dentry_cache(void);
+// Changes whenever a node is added to or removed from any tree, or the cache is reset.
+// Lets copies of the tree (see flat_tree.h) tell whether they are still current.
+uint64_t fs_get_tree_generation(void);
+// Finds a node in the directory tree by its path, loading only the directories along it.
 // Returns a pointer to the node if found, or NULL if not found.
-fs_directory_tree_node_t *fs_get_node_by_path(fs_directory_tree_node_t *root, const char *path);
+fs_directory_tree_node_t *fs_get_node_by_path(disk_t *disk, fs_directory_tree_node_t *root, const char *path);
 // Traverses the directory tree from the root to locate the node for the parent directory in a given path.
 // Returns the node if found, or NULL for invalid or non-existent paths.
-fs_directory_tree_node_t *fs_get_directory_node_by_path(fs_directory_tree_node_t *root, const char *path);
+fs_directory_tree_node_t *fs_get_directory_node_by_path(disk_t *disk, fs_directory_tree_node_t *root, const char *path);
+
+// Frees a whole tree given its root: just the arena blocks, however many nodes it has.
+void fs_free_disk_tree(fs_directory_tree_node_t *dir_tree);
 
-void fs_print_directory_tree(fs_directory_tree_node_t *dir_tree);
+typedef struct {
+    uint64_t nodes;                 // Nodes currently linked in the tree, "." and ".." included
+    uint64_t arena_allocations;     // Nodes, children arrays and indexes carved from the arena
+    uint64_t arena_blocks;          // malloc() calls behind them
+    uint64_t arena_bytes_used;      // Bytes handed out by the arena
+    uint64_t arena_bytes_reserved;  // Bytes held in arena blocks
+} fs_tree_stats_t;
 
-// Frees the memory allocated for a fs_directory_t structure
-void fs_free_directory(fs_directory_t dir);
+// Memory use of the tree a node belongs to.
+fs_tree_stats_t fs_get_tree_stats(const fs_directory_tree_node_t *node);
 
-void fs_free_disk_tree(fs_directory_tree_node_t *dir_tree);
+// Packs a path component ("NAME.EXT", ".", "..") the way the directory entry stores it, space padded.
+// Fails for names that can not be an 8.3 entry, which then match nothing.
+bool fs_pack_name(const char *name, fs_fat_compatible_filename_t *packed);
 
 // Extracts the filename from a given path. That is the part after the last '/' or '\' character.
 fs_fat_compatible_filename_t fs_get_filename_from_path(const char *path);
 
 // Returns the total size of the file system in bytes. Returns 0 on error.
-uint32_t fs_write_file_to_data_area(FILE *source_file, FILE *disk, uint16_t **cluster_list);
-bool fs_write_cluster_chain_to_fat_table(FILE *disk, uint16_t *cluster_list);
-// Adds a file to the disk, does not update the directory tree.
-bool fs_add_file_to_directory(FILE *disk, fs_directory_tree_node_t *dir_node, fat12_file_subdir_s file_entry);
-
-bool fs_remove_file_or_directory(FILE *disk, fs_directory_tree_node_t *dir_node);
+// Clusters are picked by the FAT allocation policy, parent_cluster is the first cluster of the target directory (0 for the root).
+uint32_t fs_write_file_to_data_area(FILE *source_file, disk_t *disk, uint16_t parent_cluster, uint16_t **cluster_list);
+bool fs_write_cluster_chain_to_fat_table(disk_t *disk, uint16_t *cluster_list);
+// Adds a file to the disk and, if dir_node's children are loaded, to the directory tree.
+// Fails without writing anything when the directory already has an entry with that name.
+bool fs_add_file_to_directory(disk_t *disk, fs_directory_tree_node_t *dir_node, fat12_file_subdir_s file_entry);
+
+// Removes a file or a directory with everything below it, as one metadata transaction.
+// The root and the "." / ".." entries are refused. On success dir_node is unlinked from the tree and freed.
+bool fs_remove_file_or_directory(disk_t *disk, fs_directory_tree_node_t *dir_node);
+
+// Metadata transactions on the mounted volume (see fat12_begin_transaction()).
+// FAT and directory entry changes made in between are written together on commit. Abort leaves the image and
+// the in-memory state as they were at begin. A failed commit restores the in-memory state too, and the image as
+// far as the disk still accepts writes (see fat12_commit_transaction()); the owners and the tree are rebuilt
+// from what the image holds.
+void fs_begin_transaction(void);
+bool fs_commit_transaction(disk_t *disk);
+void fs_abort_transaction(disk_t *disk);
 
 #endif  // FILE_SYSTEM_H
\ No newline at end of file
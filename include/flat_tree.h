@@ -0,0 +1,49 @@
+#ifndef FLAT_TREE_H
+#define FLAT_TREE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "disk.h"
+#include "file_system.h"
+
+// Read-only, flat copy of a directory tree for whole-tree traversals (ls, du, find).
+// Nodes are numbered in breadth-first order, so the root is 0, every parent comes before its children and the
+// children of a node are the contiguous range [first_child, first_child + child_count). Each field lives in its own
+// array indexed by node, with 32-bit indices instead of pointers, so a pass over one field streams through
+// memory. The copy does not follow later changes: compare fs_get_tree_generation() with `generation`.
+
+#define FT_NONE UINT32_MAX  // Parent of the root
+
+typedef struct {
+    uint32_t count;                        // Number of nodes
+    uint64_t generation;                   // fs_get_tree_generation() when the copy was taken
+    fs_fat_compatible_filename_t *names;   // Packed 8.3 names, as in the directory entries
+    uint8_t *attributes;                   // FAT12_ATTR_* bits, the root is marked as a directory
+    uint16_t *first_clusters;
+    uint32_t *sizes;                       // File sizes in bytes, 0 for directories
+    uint32_t *parents;                     // FT_NONE for the root
+    uint32_t *first_children;
+    uint32_t *child_counts;
+    uint8_t *depths;
+} ft_tree_t;
+
+// Loads every directory below root (see fs_load_subtree()) and copies the tree into flat.
+// Returns false, with flat left empty, if a directory can not be read or memory runs out.
+bool ft_build(ft_tree_t *flat, disk_t *disk, fs_directory_tree_node_t *root);
+void ft_free(ft_tree_t *flat);
+
+// True for "." and "..", which are listed but never descended into or counted.
+bool ft_is_dot_entry(const ft_tree_t *flat, uint32_t node);
+bool ft_is_directory(const ft_tree_t *flat, uint32_t node);
+
+// Prints the tree as an ASCII drawing, subdirectories marked with a trailing '/'.
+void ft_print(const ft_tree_t *flat);
+// Fills totals[node] with the bytes of every file below node, in one backward pass. totals holds count entries.
+void ft_subtree_sizes(const ft_tree_t *flat, uint64_t *totals);
+// Appends to *matches (stb_ds array) every node with the given name, scanning only the names. Returns the count.
+uint32_t ft_find(const ft_tree_t *flat, const char *name, uint32_t **matches);
+// Writes the absolute path of node into buffer.
+void ft_path(const ft_tree_t *flat, uint32_t node, char *buffer, size_t size);
+
+#endif  // FLAT_TREE_H
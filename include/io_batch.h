@@ -0,0 +1,31 @@
+#ifndef IO_BATCH_H
+#define IO_BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "defines.h"
+
+// Batched sector I/O. Requests are queued and then submitted together with iob_submit_and_wait().
+// On Linux the batch goes through an io_uring (one io_uring_enter per ring full of requests);
+// everywhere else, or when the kernel refuses to create a ring, the requests run one by one
+// through the synchronous block layer. If io_uring_enter fails mid-batch, the ring is torn down and the rest of
+// the batch, and every later one, takes the synchronous path.
+
+#define IOB_DEFAULT_QUEUE_DEPTH 64
+
+// Sets up the engine. With use_io_uring = false, or if the ring cannot be created, the synchronous path is used.
+void iob_init(bool use_io_uring, unsigned queue_depth);
+void iob_destroy(void);
+bool iob_uses_io_uring(void);
+
+// Queues a read of `count` sectors into a contiguous buffer. The buffer must stay valid until the batch is submitted.
+void iob_queue_read(int fd, void *buffer, uint32_t first_sector, uint32_t count);
+// Queues a write of `count` consecutive sectors gathered from separate sector buffers (see bd_writev_sectors()).
+// The sector buffers must stay valid until the batch is submitted, the pointer array itself is copied.
+void iob_queue_writev(int fd, const uint8_t *const *sectors, uint32_t first_sector, uint32_t count);
+
+// Submits every queued request and waits for all of them. Returns false if any request failed.
+bool iob_submit_and_wait(void);
+
+#endif  // IO_BATCH_H
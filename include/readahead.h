@@ -0,0 +1,55 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "defines.h"
+#include "disk.h"
+
+// Readahead over a cluster chain, for consumers that walk a chain front to back (file export).
+// Clusters are loaded a window at a time into a private buffer. While the stream is read sequentially
+// the window doubles every time it is fully consumed, up to RA_MAX_WINDOW; a jump resets it to RA_MIN_WINDOW
+// and a window left with clusters that were never handed out (the reader skipped over them) halves it.
+// The clusters after the current window are hinted to the kernel (fat12_advise_clusters()) so they are
+// already in the page cache when the next window is read.
+
+#define RA_MIN_WINDOW 4   // Clusters
+#define RA_MAX_WINDOW 64  // Clusters, 32 KiB with one sector per cluster; at most 64 (one bit each in buffer_handed)
+
+typedef struct {
+    uint64_t streams;     // Streams opened
+    uint64_t hits;        // Cluster requests served from the window buffer
+    uint64_t misses;      // Cluster requests that had to load a new window
+    uint64_t windows;     // Window loads, each one batched read of its extents
+    uint64_t prefetched;  // Clusters loaded ahead of the request that triggered the window
+    uint64_t wasted;      // Prefetched clusters dropped without being used
+    uint64_t advised;     // Clusters hinted with WILLNEED before being read
+} ra_stats_t;
+
+typedef struct {
+    disk_t *disk;
+    const uint16_t *chain;  // Not owned, must outlive the stream
+    size_t length;
+
+    uint8_t *buffer;         // RA_MAX_WINDOW clusters
+    size_t buffer_first;     // Chain index of the first buffered cluster
+    size_t buffer_count;     // Clusters currently buffered
+    uint64_t buffer_handed;  // Bit i set: buffered cluster buffer_first + i was handed out
+    size_t next;             // Index a sequential reader asks for next
+    size_t advised_until;    // Chain index up to which clusters were already hinted
+    uint32_t window;         // Current window size in clusters
+} ra_stream_t;
+
+// Prepares a stream over chain[0, length). Returns false if the window buffer cannot be allocated.
+bool ra_open(ra_stream_t *stream, disk_t *disk, const uint16_t *chain, size_t length);
+// Returns the data of chain[index] (SECTOR_SIZE bytes), or NULL on a read error.
+// WARNING: The pointer is only valid until the next call on the same stream.
+const uint8_t *ra_read_cluster(ra_stream_t *stream, size_t index);
+void ra_close(ra_stream_t *stream);
+
+ra_stats_t ra_get_stats(void);
+void ra_print_stats(void);
+
+#endif  // READAHEAD_H
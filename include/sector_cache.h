@@ -0,0 +1,57 @@
+#ifndef SECTOR_CACHE_H
+#define SECTOR_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "defines.h"
+
+// Write-back cache of whole sectors sitting on top of the block layer.
+// Holds at most budget / SECTOR_SIZE sectors and evicts the least recently used one when full.
+// Writes only mark the cached sector dirty. Dirty sectors reach the device on sc_flush(), when half of the
+// cache is dirty, or when a dirty sector would be evicted; each flush merges adjacent sectors into single writes.
+// Flushes and prefetches go through the batch engine in io_batch.h, which must be initialized first.
+
+#define SC_DEFAULT_BUDGET (64 * 1024)  // 128 sectors, enough for the root directory, FAT and a few directory chains
+
+typedef struct {
+    uint64_t hits;       // Sector requests served from memory
+    uint64_t misses;     // Sector requests that had to read the device
+    uint64_t evictions;        // Sectors dropped to make room for a miss
+    uint64_t prefetched;       // Sectors brought in ahead of use by sc_prefetch()
+    uint64_t flushes;          // Calls that wrote dirty sectors back
+    uint64_t flushed_runs;     // Device writes issued by flushes, one per run of adjacent sectors
+    uint64_t flushed_sectors;  // Sectors written back by flushes
+    size_t capacity;           // Number of sectors the budget allows
+    size_t used;               // Number of sectors currently cached
+    size_t dirty;              // Number of sectors waiting to be written back
+} sc_stats_t;
+
+// Allocates the cache with a fixed memory budget in bytes. A budget smaller than one sector disables it.
+bool sc_init(size_t budget_bytes);
+// Releases the cache memory, the statistics are kept until the next sc_init().
+// WARNING: Dirty sectors are dropped, call sc_flush() first.
+void sc_destroy(void);
+bool sc_is_enabled(void);
+
+// Returns a pointer to the cached copy of a sector, reading it from the device on a miss.
+// The pointer stays valid until the sector is evicted, which takes at least `capacity` further misses.
+const uint8_t *sc_get(int fd, uint32_t sector);
+
+bool sc_read(int fd, void *buffer, uint32_t first_sector, uint32_t count);
+bool sc_write(int fd, const void *buffer, uint32_t first_sector, uint32_t count);
+// Writes every dirty sector back to the device, one write per run of adjacent sectors, all submitted as one batch.
+bool sc_flush(int fd);
+
+// Brings the given sectors into the cache with one batched submission (see io_batch.h).
+// Sectors already cached are skipped, at most `capacity` sectors are loaded.
+bool sc_prefetch(int fd, const uint32_t *sectors, size_t n);
+// Copies dirty cached sectors in [first_sector, first_sector + count) over buffer,
+// for callers that read the device directly and must not see stale data.
+void sc_overlay_dirty(void *buffer, uint32_t first_sector, uint32_t count);
+
+sc_stats_t sc_get_stats(void);
+void sc_print_stats(void);
+
+#endif  // SECTOR_CACHE_H
@@ -1,34 +1,101 @@
 #include "app.h"
 
+#include <errno.h>
+#include <string.h>
 #include <time.h>
 
 #include "stb_ds.h"
 
-static FILE *disk = NULL;
+static disk_t *disk = NULL;
+static app_io_mode_e io_mode = APP_IO_MODE_PREAD;
+static ft_tree_t flat_tree;  // Flat copy of the mounted tree for ls, du and find, rebuilt after changes
 
 bool app_is_mounted(void) { return disk != NULL; }
 
+// Selects how the next image will be accessed, the index follows the "Modo de I/O" menu order
+void app_io_mode_callback(Menu *m) {
+    switch (m->selected_index) {
+        case APP_IO_MODE_PREAD:
+            io_mode = APP_IO_MODE_PREAD;
+            printf("Modo de I/O: pread/pwrite.\n");
+            break;
+        case APP_IO_MODE_MMAP:
+            io_mode = APP_IO_MODE_MMAP;
+            printf("Modo de I/O: mmap (imagem inteira mapeada em memoria).\n");
+            break;
+        case APP_IO_MODE_IO_URING:
+            io_mode = APP_IO_MODE_IO_URING;
+            printf("Modo de I/O: pread/pwrite com lotes via io_uring.\n");
+            break;
+        case APP_IO_MODE_DIRECT:
+            io_mode = APP_IO_MODE_DIRECT;
+            printf("Modo de I/O: pread/pwrite com O_DIRECT (blocos alinhados de %d bytes).\n", BD_DIRECT_ALIGNMENT);
+            break;
+        case APP_IO_MODE_MEMORY:
+            io_mode = APP_IO_MODE_MEMORY;
+            printf("Modo de I/O: imagem copiada para a memoria, alteracoes descartadas ao desmontar.\n");
+            break;
+        default:
+            printf("Opção inválida...\n");
+            break;
+    }
+    menu_wait_for_any_key();
+    menu_back(m);
+}
+
+// Opens the image with the backend of the selected I/O mode. The pread/pwrite backend is the fallback
+// for every other mode, and the only one that goes through the sector cache and the batch engine.
+static disk_t *_app_open_image(const char *path) {
+    disk_t *image = NULL;
+    switch (io_mode) {
+        case APP_IO_MODE_MMAP:
+            if ((image = disk_open_mmap(path)) != NULL) return image;
+            printf("Nao foi possivel mapear a imagem, usando pread/pwrite.\n");
+            break;
+        case APP_IO_MODE_MEMORY:
+            if ((image = disk_open_memory(path)) != NULL) return image;
+            printf("Nao foi possivel carregar a imagem em memoria, usando pread/pwrite.\n");
+            break;
+        case APP_IO_MODE_DIRECT:
+            image = disk_open_file(path, true);
+            if (image == NULL) printf("O_DIRECT recusado (%s), usando I/O com buffer.\n", strerror(errno));
+            break;
+        default:
+            break;
+    }
+
+    iob_init(io_mode == APP_IO_MODE_IO_URING, IOB_DEFAULT_QUEUE_DEPTH);
+    if (!sc_init(SC_DEFAULT_BUDGET)) {
+        printf("Nao foi possivel alocar o cache de setores, seguindo sem cache.\n");
+    }
+    return image != NULL ? image : disk_open_file(path, false);
+}
+
 void app_mount_callback(Menu *m) {
     if (app_is_mounted()) {
         printf("Imagem ja esta montada.\n");
     } else {
         switch (m->selected_index) {
             case 0:
-                disk = fopen(PATH_FAT12_IMG, "r+b");
+                disk = _app_open_image(PATH_FAT12_IMG);
                 if (disk == NULL) {
                     perror("Failed to open disk image");
                     exit(EXIT_FAILURE);
                 }
                 fat12_load_full_fat_table(disk);
+                co_build(disk);
+                fs_reset_dentry_cache();
                 printf("Imagem montada com sucesso em \'/\'.\n");
                 break;
             case 1:
-                disk = fopen(PATH_FAT12SUBDIR_IMG, "r+b");
+                disk = _app_open_image(PATH_FAT12SUBDIR_IMG);
                 if (disk == NULL) {
                     perror("Failed to open disk image");
                     exit(EXIT_FAILURE);
                 }
                 fat12_load_full_fat_table(disk);
+                co_build(disk);
+                fs_reset_dentry_cache();
                 printf("Imagem montada com sucesso em \'/\'.\n");
                 break;
             default:
@@ -44,7 +111,13 @@ void app_unmount_callback(Menu *m) {
     if (!app_is_mounted()) {
         printf("Nenhuma imagem montada.\n");
     } else {
-        fclose(disk);
+        disk_flush(disk);
+        disk_close(disk);
+        co_reset();
+        fs_reset_dentry_cache();
+        ft_free(&flat_tree);
+        sc_destroy();
+        iob_destroy();
         disk = NULL;  // Desmonta a imagem
         printf("Imagem desmontada com sucesso.\n");
     }
@@ -52,6 +125,34 @@ void app_unmount_callback(Menu *m) {
     menu_back(m);  // Permite que o menu seja trocado
 }
 
+void app_io_stats_callback(Menu *m) {
+    UNUSED(m);
+    ra_print_stats();
+
+    fat12_chain_cache_stats_s chains = fat12_get_chain_cache_stats();
+    printf("\n===== CACHE DE CADEIAS =====\n\n");
+    printf("Cadeias em cache: %llu\n", (unsigned long long)chains.chains);
+    printf("Acertos: %llu\n", (unsigned long long)chains.hits);
+    printf("Faltas: %llu\n", (unsigned long long)chains.misses);
+    printf("Invalidacoes: %llu\n", (unsigned long long)chains.invalidations);
+
+    fs_tree_stats_t tree = fs_get_tree_stats(fs_get_dentry_cache());
+    printf("\n===== ARVORE DE DIRETORIOS =====\n\n");
+    printf("Nos: %llu\n", (unsigned long long)tree.nodes);
+    printf("Alocacoes na arena: %llu em %llu blocos\n", (unsigned long long)tree.arena_allocations,
+           (unsigned long long)tree.arena_blocks);
+    printf("Bytes usados: %llu de %llu\n", (unsigned long long)tree.arena_bytes_used,
+           (unsigned long long)tree.arena_bytes_reserved);
+
+    printf("\nBackend: %s\n", disk_name(disk));
+    if (!sc_is_enabled()) {
+        printf("Nenhum acesso passa pelo cache de setores neste backend.\n");
+        return;
+    }
+    printf("Transferencias em lote: %s\n", iob_uses_io_uring() ? "io_uring" : "sincronas");
+    sc_print_stats();
+}
+
 void app_boot_sector_callback(Menu *m) {
     UNUSED(m);
     if (!app_is_mounted()) {
@@ -64,7 +165,11 @@ void app_boot_sector_callback(Menu *m) {
 void app_ls1_callback(Menu *m) {
     UNUSED(m);
 
-    fs_directory_t root_dir = fs_read_root_directory(disk);
+    fs_directory_tree_node_t *root = fs_get_dentry_cache();
+    if (!fs_load_children(disk, root)) {
+        printf("Erro ao ler o diretorio raiz.\n");
+        return;
+    }
 
     printf("\n=======  LISTANDO DIRETORIO RAIZ  =======\n");
     printf("-----------------------------------------\n");
@@ -73,42 +178,149 @@ void app_ls1_callback(Menu *m) {
 
     printf("----------------------------------------------------------------------------------------------------------------\n");
 
-    for (int i = 0; i < arrlen(root_dir.subdirs); i++) {
-        fat12_file_subdir_s subdir = root_dir.subdirs[i];
-        fs_print_file_leaf(subdir, 0);
+    for (size_t i = 0; i < root->children_count; i++) {
+        if (root->children[i]->type == FS_DIRECTORY_TYPE_SUBDIR) {
+            fs_print_file_leaf(root->children[i]->metadata, 0);
+        }
     }
 
-    for (int i = 0; i < arrlen(root_dir.files); i++) {
-        fat12_file_subdir_s file = root_dir.files[i];
-        fs_print_file_leaf(file, 0);
+    for (size_t i = 0; i < root->children_count; i++) {
+        if (root->children[i]->type == FS_DIRECTORY_TYPE_FILE) {
+            fs_print_file_leaf(root->children[i]->metadata, 0);
+        }
     }
+}
 
-    fs_free_directory(root_dir);
+// Returns the flat copy of the mounted tree, taken again only if the tree changed since the last one.
+// NULL if the tree can not be read.
+static const ft_tree_t *_app_flat_tree(void) {
+    if (flat_tree.count == 0 || flat_tree.generation != fs_get_tree_generation()) {
+        ft_free(&flat_tree);
+        if (!ft_build(&flat_tree, disk, fs_get_dentry_cache())) {
+            printf("Erro ao ler a arvore de diretorios.\n");
+            return NULL;
+        }
+    }
+    return &flat_tree;
 }
 
 // List all files and directories
 void app_ls_callback(Menu *m) {
     UNUSED(m);
-    fs_directory_tree_node_t *disk_tree = fs_create_disk_tree(disk);
+    const ft_tree_t *tree = _app_flat_tree();
+    if (tree == NULL) return;
     printf("\n=======  LISTANDO ARVORE DE DIRETORIOS  =======\n");
-    fs_print_directory_tree(disk_tree);
-    fs_free_disk_tree(disk_tree);
+    ft_print(tree);
+}
+
+// Bytes used by the files below each directory
+void app_du_callback(Menu *m) {
+    UNUSED(m);
+    const ft_tree_t *tree = _app_flat_tree();
+    if (tree == NULL || tree->count == 0) return;
+
+    uint64_t *totals = malloc(tree->count * sizeof(*totals));
+    if (totals == NULL) {
+        perror("Erro ao alocar os totais");
+        return;
+    }
+    ft_subtree_sizes(tree, totals);
+
+    printf("\n=======  USO POR DIRETORIO  =======\n");
+    printf("Bytes\t\tDiretorio\n");
+    for (uint32_t i = 0; i < tree->count; i++) {
+        if (!ft_is_directory(tree, i) || ft_is_dot_entry(tree, i)) continue;
+
+        char path[APP_MAX_PATH_LENGTH];
+        ft_path(tree, i, path, sizeof(path));
+        printf("%llu\t\t%s\n", (unsigned long long)totals[i], path);
+    }
+    free(totals);
+}
+
+void app_find_callback(Menu *m, const char *input) {
+    UNUSED(m);
+    const ft_tree_t *tree = _app_flat_tree();
+    if (tree == NULL) return;
+
+    uint32_t *matches = NULL;
+    ft_find(tree, input, &matches);
+
+    printf("\n=======  PROCURANDO '%s'  =======\n", input);
+    for (int i = 0; i < arrlen(matches); i++) {
+        char path[APP_MAX_PATH_LENGTH];
+        ft_path(tree, matches[i], path, sizeof(path));
+        printf("%s%s\n", path, ft_is_directory(tree, matches[i]) ? "/" : "");
+    }
+    printf("%d entradas encontradas.\n", (int)arrlen(matches));
+    arrfree(matches);
+}
+
+// Free space report, served from the free cluster map without walking the FAT
+void app_df_callback(Menu *m) {
+    UNUSED(m);
+    uint32_t total = fat12_count_data_clusters();
+    uint32_t free_clusters = fat12_count_free_clusters();
+    uint32_t used = total - free_clusters;
+
+    printf("\n=======  ESPACO EM DISCO  =======\n");
+    printf("Clusters\tUsados\t\tLivres\t\tUso\n");
+    printf("%u\t\t%u\t\t%u\t\t%.1f%%\n", total, used, free_clusters, total ? (100.0 * used) / total : 0.0);
+    printf("\nBytes\t\tUsados\t\tLivres\n");
+    printf("%u\t\t%u\t\t%u\n", total * SECTOR_SIZE, used * SECTOR_SIZE, free_clusters * SECTOR_SIZE);
+    if (co_count_cross_links() > 0) {
+        printf("\nAviso: %u clusters pertencem a mais de uma entrada de diretorio.\n", co_count_cross_links());
+    }
+}
+
+void app_verify_fat_callback(Menu *m) {
+    UNUSED(m);
+    uint8_t copies = fat12_count_fat_copies();
+
+    printf("\n=======  VERIFICACAO DAS COPIAS DA FAT  =======\n");
+    printf("Copias da FAT: %u\n", copies);
+    if (copies < 2) {
+        printf("Nada a comparar.\n");
+        return;
+    }
+
+    disk_flush(disk);  // The comparison reads the image
+    fat12_fat_mismatch_s *mismatches = NULL;
+    if (!fat12_verify_fat_copies(disk, copies, &mismatches)) {
+        fprintf(stderr, "Erro ao ler as copias da FAT.\n");
+        arrfree(mismatches);
+        return;
+    }
+
+    if (arrlen(mismatches) == 0) {
+        printf("Todas as copias sao identicas a FAT #1.\n");
+    } else {
+        printf("FAT\tEntrada\tFAT #1\tCopia\n");
+        for (int i = 0; i < arrlen(mismatches) && i < APP_MAX_REPORTED_MISMATCHES; i++) {
+            printf("#%u\t%u\t0x%03X\t0x%03X\n", mismatches[i].copy + 1, mismatches[i].entry, mismatches[i].expected,
+                   mismatches[i].found);
+        }
+        if (arrlen(mismatches) > APP_MAX_REPORTED_MISMATCHES) {
+            printf("... e mais %d entradas\n", (int)arrlen(mismatches) - APP_MAX_REPORTED_MISMATCHES);
+        }
+        printf("%d entradas divergentes.\n", (int)arrlen(mismatches));
+    }
+    arrfree(mismatches);
 }
 
 void app_rm_callback(Menu *m, const char *input) {
     UNUSED(m);
     printf("Removendo arquivo ou diretorio: %s\n", input);
 
-    fs_directory_tree_node_t *disk_tree = fs_create_disk_tree(disk);
+    fs_directory_tree_node_t *disk_tree = fs_get_dentry_cache();
     if (disk_tree == NULL) {
         printf("Erro ao criar a arvore de diretorios do disco.\n");
         return;
     }
 
-    fs_directory_tree_node_t *target_node = fs_get_node_by_path(disk_tree, input);
+    fs_directory_tree_node_t *target_node = fs_get_node_by_path(disk, disk_tree, input);
     if (target_node == NULL) {
         printf("Caminho '%s' nao encontrado no disco.\n", input);
-        fs_free_disk_tree(disk_tree);
         return;
     }
 
@@ -116,25 +328,23 @@ void app_rm_callback(Menu *m, const char *input) {
 
     if (!fs_remove_file_or_directory(disk, target_node)) {
         fprintf(stderr, "Erro ao remover o arquivo ou diretorio '%s'.\n", input);
-        fs_free_disk_tree(disk_tree);
-        return;
+        return;  // Rolled back, the image is unchanged
     }
     printf("Arquivo ou diretorio '%s' removido com sucesso.\n", input);
-    fs_free_disk_tree(disk_tree);
+    disk_flush(disk);
 }
 
 bool _app_copy_sys_to_disk(const char *src, const char *dst) {
     printf("Copiando do sistema para o disco...\n");
-    fs_directory_tree_node_t *disk_tree = fs_create_disk_tree(disk);
+    fs_directory_tree_node_t *disk_tree = fs_get_dentry_cache();
     if (disk_tree == NULL) {
         printf("Erro ao criar a arvore de diretorios do disco.\n");
         return false;
     }
 
-    fs_directory_tree_node_t *target_node = fs_get_node_by_path(disk_tree, src);
+    fs_directory_tree_node_t *target_node = fs_get_node_by_path(disk, disk_tree, src);
     if (target_node == NULL) {
         printf("Caminho '%s' nao encontrado no disco.\n", src);
-        fs_free_disk_tree(disk_tree);
         return false;
     }
 
@@ -151,28 +361,47 @@ bool _app_copy_sys_to_disk(const char *src, const char *dst) {
         return false;
     }
 
-    uint32_t remaining_size = target_node->metadata.file_size;
-    for (int i = 0; i < arrlen(cluster_list); i++) {
-        printf("Escrevendo %i/%llu...\n", i + 1, arrlen(cluster_list));
+    // Only the clusters that hold file data are read, the chain may be longer than the file
+    size_t clusters_to_read = (target_node->metadata.file_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if (clusters_to_read > (size_t)arrlen(cluster_list)) {
+        clusters_to_read = arrlen(cluster_list);
+    }
+    printf("Lendo %zu clusters...\n", clusters_to_read);
+
+    // Streamed through a readahead window, so memory stays bounded whatever the file size
+    ra_stream_t stream;
+    if (!ra_open(&stream, disk, cluster_list, clusters_to_read)) {
+        fclose(target_file);
+        arrfree(cluster_list);
+        return false;
+    }
 
-        uint8_t buffer[SECTOR_SIZE];
-        if (!fat12_read_data_sector(disk, buffer, cluster_list[i])) {
-            fprintf(stderr, "Erro ao ler o setor de dados do cluster %d\n", cluster_list[i]);
+    // Host writes go out in window sized chunks too, glibc ignores the size unless it is given the buffer
+    char *host_buffer = malloc(RA_MAX_WINDOW * SECTOR_SIZE);
+    if (host_buffer != NULL) setvbuf(target_file, host_buffer, _IOFBF, RA_MAX_WINDOW * SECTOR_SIZE);
+
+    size_t remaining = target_node->metadata.file_size;
+    for (size_t i = 0; i < clusters_to_read && remaining > 0; i++) {
+        const uint8_t *cluster = ra_read_cluster(&stream, i);
+        if (cluster == NULL) {
+            fprintf(stderr, "Erro ao ler os clusters de %s\n", target_node->metadata.filename);
+            ra_close(&stream);
+            fclose(target_file);
+            free(host_buffer);
             arrfree(cluster_list);
-            fs_free_disk_tree(disk_tree);
             return false;
         }
 
-        size_t to_write = (remaining_size > SECTOR_SIZE) ? SECTOR_SIZE : remaining_size;
-        fwrite(buffer, 1, to_write, target_file);
-        remaining_size -= to_write;
-        if (remaining_size == 0) break;  // no more data to write
+        size_t to_write = remaining < SECTOR_SIZE ? remaining : SECTOR_SIZE;
+        fwrite(cluster, 1, to_write, target_file);
+        remaining -= to_write;
     }
+    ra_close(&stream);
 
     fclose(target_file);
-    fs_free_disk_tree(disk_tree);
+    free(host_buffer);
     arrfree(cluster_list);
-    fflush(disk);
+    disk_flush(disk);
     return true;
 }
 
@@ -185,16 +414,20 @@ bool _app_copy_disk_to_sys(const char *src, const char *dst) {
         return false;
     }
 
-    fs_directory_tree_node_t *disk_tree = fs_create_disk_tree(disk);
+    fs_directory_tree_node_t *disk_tree = fs_get_dentry_cache();
     if (disk_tree == NULL) {
         printf("Erro ao criar a arvore de diretorios do disco.\n");
         return false;
     }
 
-    fs_directory_tree_node_t *target_node = fs_get_directory_node_by_path(disk_tree, dst);
+    fs_directory_tree_node_t *target_node = fs_get_directory_node_by_path(disk, disk_tree, dst);
     if (target_node == NULL) {
         printf("Caminho '%s' nao encontrado no disco.\n", dst);
-        fs_free_disk_tree(disk_tree);
+        return false;
+    }
+
+    if (fs_get_node_by_path(disk, disk_tree, dst) != NULL) {
+        printf("Ja existe uma entrada '%s' no disco.\n", dst);
         return false;
     }
 
@@ -209,7 +442,7 @@ bool _app_copy_disk_to_sys(const char *src, const char *dst) {
 
     uint16_t *cluster_list = NULL;
 
-    uint32_t file_size = fs_write_file_to_data_area(source_file, disk, &cluster_list);
+    uint32_t file_size = fs_write_file_to_data_area(source_file, disk, target_node->metadata.first_cluster, &cluster_list);
 
     if (!file_size) {
         fprintf(stderr, "Erro ao escrever o arquivo na area de dados.\n");
@@ -218,8 +451,11 @@ bool _app_copy_disk_to_sys(const char *src, const char *dst) {
         return false;
     }
 
+    // The chain and the directory entry are committed together
+    fs_begin_transaction();
     if (!fs_write_cluster_chain_to_fat_table(disk, cluster_list)) {
         fprintf(stderr, "Erro ao escrever a cadeia de clusters na tabela FAT.\n");
+        fs_abort_transaction(disk);
         fclose(source_file);
         arrfree(cluster_list);
         return false;
@@ -245,16 +481,22 @@ bool _app_copy_disk_to_sys(const char *src, const char *dst) {
 
     if (!fs_add_file_to_directory(disk, target_node, file_entry)) {
         fprintf(stderr, "Erro ao adicionar o arquivo ao diretorio.\n");
+        fs_abort_transaction(disk);
+        fclose(source_file);
+        arrfree(cluster_list);
+        return false;
+    }
+
+    if (!fs_commit_transaction(disk)) {
+        fprintf(stderr, "Erro ao gravar a tabela FAT e o diretorio.\n");
         fclose(source_file);
         arrfree(cluster_list);
-        fs_free_disk_tree(disk_tree);
         return false;
     }
 
     fclose(source_file);
     arrfree(cluster_list);
-    fs_free_disk_tree(disk_tree);
-    fflush(disk);  // Ensure all changes are written to the disk image
+    disk_flush(disk);  // Ensure all changes are written to the disk image
     return true;
 }
 
@@ -283,7 +525,7 @@ void app_copy_complete(int copy_type, const char *src, const char *dst) {
             printf("Erro: Tipo de copia desconhecido.\n");
             break;
     }
-    fflush(disk);
+    disk_flush(disk);
     menu_wait_for_any_key();
 }
 
@@ -0,0 +1,68 @@
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct arena_block {
+    struct arena_block *next;  // Older block
+    size_t size;               // Usable bytes in data
+    size_t used;               // Bytes already handed out
+    uint8_t data[] __attribute__((aligned(ARENA_ALIGNMENT)));
+} arena_block_t;
+
+static size_t _arena_align(size_t size) { return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1); }
+
+void arena_init(arena_t *arena, size_t block_size) {
+    memset(arena, 0, sizeof(*arena));
+    arena->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = _arena_align(size ? size : 1);
+
+    arena_block_t *block = arena->head;
+    if (block == NULL || block->size - block->used < size) {
+        size_t data_size = size > arena->block_size ? size : arena->block_size;
+        block = malloc(sizeof(*block) + data_size);
+        if (block == NULL) {
+            perror("malloc arena block");
+            exit(EXIT_FAILURE);
+        }
+        block->size = data_size;
+        block->used = 0;
+        arena->blocks++;
+        arena->bytes_reserved += data_size;
+
+        if (data_size > arena->block_size && arena->head != NULL) {
+            // An oversized block is full right away, keep bumping in the current one
+            block->next = arena->head->next;
+            arena->head->next = block;
+        } else {
+            block->next = arena->head;
+            arena->head = block;
+        }
+    }
+
+    void *memory = block->data + block->used;
+    block->used += size;
+    arena->allocations++;
+    arena->bytes_used += size;
+    return memory;
+}
+
+void *arena_calloc(arena_t *arena, size_t size) {
+    void *memory = arena_alloc(arena, size);
+    memset(memory, 0, size);
+    return memory;
+}
+
+void arena_release(arena_t *arena) {
+    arena_block_t *block = arena->head;
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena_init(arena, arena->block_size);
+}
@@ -0,0 +1,395 @@
+// O_DIRECT is a GNU extension in glibc's <fcntl.h>
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "block_device.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#endif
+
+#ifdef _WIN32
+// Windows has no pread/pwrite, an OVERLAPPED offset gives the same positional semantics.
+static long long _bd_pread(int fd, void *buffer, size_t size, uint64_t offset) {
+    HANDLE handle = (HANDLE)_get_osfhandle(fd);
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+    DWORD transferred = 0;
+    if (!ReadFile(handle, buffer, (DWORD)size, &transferred, &overlapped)) {
+        errno = EIO;
+        return -1;
+    }
+    return transferred;
+}
+
+static long long _bd_pwrite(int fd, const void *buffer, size_t size, uint64_t offset) {
+    HANDLE handle = (HANDLE)_get_osfhandle(fd);
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+    DWORD transferred = 0;
+    if (!WriteFile(handle, buffer, (DWORD)size, &transferred, &overlapped)) {
+        errno = EIO;
+        return -1;
+    }
+    return transferred;
+}
+#else
+static long long _bd_pread(int fd, void *buffer, size_t size, uint64_t offset) {
+    return pread(fd, buffer, size, (off_t)offset);
+}
+
+static long long _bd_pwrite(int fd, const void *buffer, size_t size, uint64_t offset) {
+    return pwrite(fd, buffer, size, (off_t)offset);
+}
+#endif
+
+static bool _bd_buffered_read(int fd, void *buffer, uint32_t first_sector, uint32_t count) {
+    uint8_t *cursor = buffer;
+    size_t remaining = (size_t)count * SECTOR_SIZE;
+    uint64_t offset = (uint64_t)first_sector * SECTOR_SIZE;
+
+    // pread may return less than requested (signals, pipes), so loop until done
+    while (remaining > 0) {
+        long long bytes_read = _bd_pread(fd, cursor, remaining, offset);
+        if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (bytes_read == 0) {
+            errno = EIO;  // Reading past the end of the image
+            return false;
+        }
+        cursor += bytes_read;
+        offset += bytes_read;
+        remaining -= bytes_read;
+    }
+
+    return true;
+}
+
+static bool _bd_buffered_write(int fd, const void *buffer, uint32_t first_sector, uint32_t count) {
+    const uint8_t *cursor = buffer;
+    size_t remaining = (size_t)count * SECTOR_SIZE;
+    uint64_t offset = (uint64_t)first_sector * SECTOR_SIZE;
+
+    while (remaining > 0) {
+        long long bytes_written = _bd_pwrite(fd, cursor, remaining, offset);
+        if (bytes_written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (bytes_written == 0) {
+            errno = EIO;  // No progress (device full, file size limit), retrying would spin forever
+            return false;
+        }
+        cursor += bytes_written;
+        offset += bytes_written;
+        remaining -= bytes_written;
+    }
+
+    return true;
+}
+
+static bool _bd_buffered_writev(int fd, const uint8_t *const *sectors, uint32_t first_sector, uint32_t count) {
+#ifdef _WIN32
+    // No pwritev, fall back to one write per sector
+    for (uint32_t i = 0; i < count; i++) {
+        if (!_bd_buffered_write(fd, sectors[i], first_sector + i, 1)) return false;
+    }
+    return true;
+#else
+    struct iovec iov[IOV_MAX];
+
+    while (count > 0) {
+        uint32_t batch = count < IOV_MAX ? count : IOV_MAX;
+        for (uint32_t i = 0; i < batch; i++) {
+            iov[i].iov_base = (void *)sectors[i];
+            iov[i].iov_len = SECTOR_SIZE;
+        }
+
+        ssize_t bytes_written;
+        do {
+            bytes_written = pwritev(fd, iov, batch, (off_t)first_sector * SECTOR_SIZE);
+        } while (bytes_written < 0 && errno == EINTR);
+
+        if (bytes_written < 0) return false;
+        if (bytes_written != (ssize_t)batch * SECTOR_SIZE) {
+            // Short vectored write, finish the remaining sectors one by one (a partially written sector is rewritten whole)
+            uint32_t done = bytes_written / SECTOR_SIZE;
+            for (uint32_t i = done; i < batch; i++) {
+                if (!_bd_buffered_write(fd, sectors[i], first_sector + i, 1)) return false;
+            }
+        }
+
+        sectors += batch;
+        first_sector += batch;
+        count -= batch;
+    }
+    return true;
+#endif
+}
+
+#ifdef O_DIRECT
+// Descriptors opened through bd_open_direct(), one bit per fd, changed and read atomically
+static uint64_t direct_fds[BD_MAX_DIRECT_FD / 64];
+// Device size of each direct descriptor, taken at open. Aligned spans never reach past it.
+static uint64_t direct_sizes[BD_MAX_DIRECT_FD];
+
+// Small pool of aligned bounce buffers so O_DIRECT transfers do not call posix_memalign every time.
+// A slot is claimed by atomically setting busy, so concurrent callers never share a buffer; only the claimer
+// allocates the buffer of a slot, which then stays until the process exits.
+static struct {
+    void *buffer;
+    bool busy;
+} direct_pool[BD_DIRECT_POOL_BUFFERS];
+
+static void *_bd_pool_acquire(size_t size) {
+    if (size <= BD_DIRECT_POOL_BUFFER_SIZE) {
+        for (int i = 0; i < BD_DIRECT_POOL_BUFFERS; i++) {
+            if (__atomic_test_and_set(&direct_pool[i].busy, __ATOMIC_ACQUIRE)) continue;
+
+            void *buffer = __atomic_load_n(&direct_pool[i].buffer, __ATOMIC_ACQUIRE);
+            if (buffer == NULL) {
+                if (posix_memalign(&buffer, BD_DIRECT_ALIGNMENT, BD_DIRECT_POOL_BUFFER_SIZE) != 0) {
+                    __atomic_clear(&direct_pool[i].busy, __ATOMIC_RELEASE);
+                    return NULL;
+                }
+                __atomic_store_n(&direct_pool[i].buffer, buffer, __ATOMIC_RELEASE);
+            }
+            return buffer;
+        }
+    }
+
+    // Pool exhausted or transfer too large, use a one-off aligned buffer
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, BD_DIRECT_ALIGNMENT, size) != 0) return NULL;
+    return buffer;
+}
+
+static void _bd_pool_release(void *buffer) {
+    for (int i = 0; i < BD_DIRECT_POOL_BUFFERS; i++) {
+        if (__atomic_load_n(&direct_pool[i].buffer, __ATOMIC_ACQUIRE) == buffer) {
+            __atomic_clear(&direct_pool[i].busy, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+    free(buffer);
+}
+
+// Reads up to size bytes, stopping early only at the end of the device. Returns the bytes read or -1.
+static long long _bd_read_span(int fd, uint8_t *buffer, size_t size, uint64_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        long long bytes_read = _bd_pread(fd, buffer + done, size - done, offset + done);
+        if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (bytes_read == 0) break;
+        done += bytes_read;
+    }
+    return done;
+}
+
+// The aligned block span [first_block, first_block + blocks) that covers the requested sectors
+static void _bd_direct_span(uint32_t first_sector, uint32_t count, uint32_t *first_block, uint32_t *blocks) {
+    *first_block = first_sector / BD_DIRECT_SECTORS_PER_BLOCK;
+    uint32_t end_block = (first_sector + count + BD_DIRECT_SECTORS_PER_BLOCK - 1) / BD_DIRECT_SECTORS_PER_BLOCK;
+    *blocks = end_block - *first_block;
+}
+
+static bool _bd_direct_read(int fd, void *buffer, uint32_t first_sector, uint32_t count) {
+    uint32_t first_block, blocks;
+    _bd_direct_span(first_sector, count, &first_block, &blocks);
+
+    size_t span = (size_t)blocks * BD_DIRECT_ALIGNMENT;
+    uint8_t *bounce = _bd_pool_acquire(span);
+    if (bounce == NULL) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    size_t skip = (size_t)(first_sector - first_block * BD_DIRECT_SECTORS_PER_BLOCK) * SECTOR_SIZE;
+    long long bytes_read = _bd_read_span(fd, bounce, span, (uint64_t)first_block * BD_DIRECT_ALIGNMENT);
+    bool ok = bytes_read >= 0 && (size_t)bytes_read >= skip + (size_t)count * SECTOR_SIZE;
+    if (ok) {
+        memcpy(buffer, bounce + skip, (size_t)count * SECTOR_SIZE);
+    } else if (bytes_read >= 0) {
+        errno = EIO;  // Reading past the end of the device
+    }
+
+    _bd_pool_release(bounce);
+    return ok;
+}
+
+// Writes sectors taken either from a contiguous buffer or from an array of sector pointers.
+// Partial blocks at either end are read first so the aligned write does not clobber their neighbours.
+static bool _bd_direct_write(int fd, const void *buffer, const uint8_t *const *sectors, uint32_t first_sector, uint32_t count) {
+    uint32_t first_block, blocks;
+    _bd_direct_span(first_sector, count, &first_block, &blocks);
+
+    size_t span = (size_t)blocks * BD_DIRECT_ALIGNMENT;
+    uint8_t *bounce = _bd_pool_acquire(span);
+    if (bounce == NULL) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    uint64_t offset = (uint64_t)first_block * BD_DIRECT_ALIGNMENT;
+    if (offset + span > __atomic_load_n(&direct_sizes[fd], __ATOMIC_ACQUIRE)) {
+        _bd_pool_release(bounce);
+        errno = EIO;  // Writing past the end of the device would grow an image
+        return false;
+    }
+
+    size_t skip = (size_t)(first_sector - first_block * BD_DIRECT_SECTORS_PER_BLOCK) * SECTOR_SIZE;
+    bool partial = skip != 0 || (first_sector + count) % BD_DIRECT_SECTORS_PER_BLOCK != 0;
+    if (partial) {
+        long long bytes_read = _bd_read_span(fd, bounce, span, offset);
+        if (bytes_read < 0) {
+            _bd_pool_release(bounce);
+            return false;
+        }
+        // The pooled buffer still holds an older transfer, never write that back
+        memset(bounce + bytes_read, 0, span - (size_t)bytes_read);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *src = sectors ? sectors[i] : (const uint8_t *)buffer + (size_t)i * SECTOR_SIZE;
+        memcpy(bounce + skip + (size_t)i * SECTOR_SIZE, src, SECTOR_SIZE);
+    }
+
+    size_t done = 0;
+    bool ok = true;
+    while (done < span) {
+        long long bytes_written = _bd_pwrite(fd, bounce + done, span - done, offset + done);
+        if (bytes_written < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+            break;
+        }
+        if (bytes_written == 0) {
+            errno = EIO;  // Same as the buffered path, a write that makes no progress is an error
+            ok = false;
+            break;
+        }
+        done += bytes_written;
+    }
+
+    _bd_pool_release(bounce);
+    return ok;
+}
+#endif
+
+int bd_open_direct(const char *path) {
+#ifdef O_DIRECT
+    int fd = open(path, O_RDWR | O_DIRECT);
+    if (fd < 0) return -1;
+    if (fd >= BD_MAX_DIRECT_FD) {
+        close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+
+    // Transfers cover whole aligned blocks, so a trailing partial block could only be written by growing the image
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size < 0 || size % BD_DIRECT_ALIGNMENT != 0) {
+        int error = size < 0 ? errno : EINVAL;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    __atomic_store_n(&direct_sizes[fd], (uint64_t)size, __ATOMIC_RELEASE);
+
+    // Some filesystems accept the flag at open time and only reject the first transfer
+    uint8_t probe[SECTOR_SIZE];
+    __atomic_fetch_or(&direct_fds[fd / 64], 1ULL << (fd % 64), __ATOMIC_RELEASE);
+    if (!_bd_direct_read(fd, probe, 0, 1)) {
+        int error = errno;
+        bd_release_direct(fd);
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+#else
+    UNUSED(path);
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+void bd_release_direct(int fd) {
+#ifdef O_DIRECT
+    if (fd >= 0 && fd < BD_MAX_DIRECT_FD) {
+        __atomic_fetch_and(&direct_fds[fd / 64], ~(1ULL << (fd % 64)), __ATOMIC_RELEASE);
+    }
+#else
+    UNUSED(fd);
+#endif
+}
+
+bool bd_is_direct(int fd) {
+#ifdef O_DIRECT
+    if (fd < 0 || fd >= BD_MAX_DIRECT_FD) return false;
+    return (__atomic_load_n(&direct_fds[fd / 64], __ATOMIC_ACQUIRE) >> (fd % 64)) & 1;
+#else
+    UNUSED(fd);
+    return false;
+#endif
+}
+
+uint32_t bd_transfer_granularity(int fd) {
+    return bd_is_direct(fd) ? BD_DIRECT_SECTORS_PER_BLOCK : 1;
+}
+
+bool bd_read_sectors(int fd, void *buffer, uint32_t first_sector, uint32_t count) {
+    assert(fd >= 0);
+    assert(buffer != NULL);
+
+#ifdef O_DIRECT
+    if (bd_is_direct(fd)) return _bd_direct_read(fd, buffer, first_sector, count);
+#endif
+    return _bd_buffered_read(fd, buffer, first_sector, count);
+}
+
+bool bd_write_sectors(int fd, const void *buffer, uint32_t first_sector, uint32_t count) {
+    assert(fd >= 0);
+    assert(buffer != NULL);
+
+#ifdef O_DIRECT
+    if (bd_is_direct(fd)) return _bd_direct_write(fd, buffer, NULL, first_sector, count);
+#endif
+    return _bd_buffered_write(fd, buffer, first_sector, count);
+}
+
+bool bd_writev_sectors(int fd, const uint8_t *const *sectors, uint32_t first_sector, uint32_t count) {
+    assert(fd >= 0);
+    assert(sectors != NULL);
+
+#ifdef O_DIRECT
+    if (bd_is_direct(fd)) return _bd_direct_write(fd, NULL, sectors, first_sector, count);
+#endif
+    return _bd_buffered_writev(fd, sectors, first_sector, count);
+}
@@ -0,0 +1,125 @@
+#include "cluster_owner.h"
+
+#include "file_system.h"
+#include "stb_ds.h"
+
+static co_owner_s owners[FAT12_FAT_TABLE_ENTRY_CAPACITY];
+static bool has_owner[FAT12_FAT_TABLE_ENTRY_CAPACITY];
+static uint32_t cross_links = 0;
+static bool is_built = false;
+
+static bool _co_same_dirent(fat12_dir_entry_s a, fat12_dir_entry_s b) {
+    return a.cluster == b.cluster && a.idx == b.idx;
+}
+
+// Entries that own clusters: in use, not a volume label or long name, not "." / ".."
+static bool _co_is_owning_entry(const fat12_file_subdir_s *entry) {
+    uint8_t first = (uint8_t)entry->filename[0];
+    if (first == 0x00 || first == 0xE5 || first == '.') return false;
+    if (entry->attributes & FAT12_ATTR_VOLUME_LABEL) return false;
+    return entry->first_cluster >= FAT12_DATA_AREA_NUMBER_OFFSET && entry->first_cluster < (FAT12_MAX_CLUSTER_NUMBER);
+}
+
+static void _co_build_directory(disk_t *disk, uint16_t dir_cluster, size_t depth);
+
+static void _co_build_entry(disk_t *disk, fat12_dir_entry_s dirent, fat12_file_subdir_s entry, size_t depth) {
+    if (!_co_is_owning_entry(&entry)) return;
+
+    co_assign(dirent, entry.first_cluster);
+    if (entry.attributes & FAT12_ATTR_DIRECTORY) {
+        _co_build_directory(disk, entry.first_cluster, depth + 1);
+    }
+}
+
+static void _co_build_directory(disk_t *disk, uint16_t dir_cluster, size_t depth) {
+    if (depth >= FS_MAX_DIRECTORY_DEPTH) return;
+
+    uint16_t *chain = NULL;
+    if (!fat12_get_table_entry_chain(dir_cluster, &chain)) {
+        arrfree(chain);
+        return;
+    }
+
+    for (int i = 0; i < arrlen(chain); i++) {
+        for (uint8_t idx = 0; idx < FAT12_DIRECTORY_ENTRIES_PER_SECTOR; idx++) {
+            // Copied, the view does not survive the recursion
+            fat12_file_subdir_s entry = *fat12_view_directory_from_data_area(disk, chain[i], idx);
+            _co_build_entry(disk, (fat12_dir_entry_s){.cluster = chain[i], .idx = idx}, entry, depth);
+        }
+    }
+    arrfree(chain);
+}
+
+void co_build(disk_t *disk) {
+    assert(disk != NULL);
+
+    co_reset();
+    for (uint16_t i = 0; i < FAT12_ROOT_DIRECTORY_ENTRIES; i++) {
+        fat12_file_subdir_s entry = *fat12_view_directory_entry(disk, i);
+        _co_build_entry(disk, (fat12_dir_entry_s){.cluster = 0, .idx = i}, entry, 0);
+    }
+    is_built = true;
+}
+
+void co_reset(void) {
+    memset(has_owner, 0, sizeof(has_owner));
+    cross_links = 0;
+    is_built = false;
+}
+
+bool co_is_built(void) { return is_built; }
+
+void co_assign(fat12_dir_entry_s dirent, uint16_t first_cluster) {
+    uint16_t *chain = NULL;
+    if (!fat12_get_table_entry_chain(first_cluster, &chain)) {
+        arrfree(chain);
+        return;
+    }
+
+    for (int i = 0; i < arrlen(chain); i++) {
+        uint16_t cluster = chain[i];
+        if (has_owner[cluster] && !_co_same_dirent(owners[cluster].dirent, dirent)) {
+            cross_links++;
+            continue;
+        }
+        owners[cluster] = (co_owner_s){.dirent = dirent, .first_cluster = first_cluster, .file_index = i};
+        has_owner[cluster] = true;
+    }
+    arrfree(chain);
+}
+
+void co_release(uint16_t first_cluster) {
+    if (first_cluster < FAT12_DATA_AREA_NUMBER_OFFSET || !has_owner[first_cluster]) return;
+
+    fat12_dir_entry_s dirent = owners[first_cluster].dirent;
+    uint16_t *chain = NULL;
+    if (!fat12_get_table_entry_chain(first_cluster, &chain)) {
+        arrfree(chain);
+        return;
+    }
+
+    // Cross-linked clusters owned by another entry stay with it
+    for (int i = 0; i < arrlen(chain); i++) {
+        if (has_owner[chain[i]] && _co_same_dirent(owners[chain[i]].dirent, dirent)) {
+            has_owner[chain[i]] = false;
+        }
+    }
+    arrfree(chain);
+}
+
+bool co_lookup_cluster(uint16_t cluster, co_owner_s *owner) {
+    assert(owner != NULL);
+
+    if (cluster >= FAT12_FAT_TABLE_ENTRY_CAPACITY || !has_owner[cluster]) return false;
+    *owner = owners[cluster];
+    return true;
+}
+
+bool co_lookup_sector(uint32_t sector, co_owner_s *owner) {
+    if (sector < FAT12_DATA_AREA_START) return false;  // Boot sector, FAT or root directory
+    uint32_t cluster = sector - FAT12_DATA_AREA_START + FAT12_DATA_AREA_NUMBER_OFFSET;
+    if (cluster >= FAT12_FAT_TABLE_ENTRY_CAPACITY) return false;
+    return co_lookup_cluster(cluster, owner);
+}
+
+uint32_t co_count_cross_links(void) { return cross_links; }
@@ -0,0 +1,410 @@
+#include "disk.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "block_device.h"
+#include "io_batch.h"
+#include "sector_cache.h"
+
+static bool _disk_in_bounds(uint64_t size, uint32_t first_sector, uint32_t count) {
+    return ((uint64_t)first_sector + count) * SECTOR_SIZE <= size;
+}
+
+static uint64_t _disk_file_size(FILE *stream) {
+    struct stat st;
+    if (fstat(fileno(stream), &st) != 0) {
+        perror("Failed to stat disk image");
+        return 0;
+    }
+    return st.st_size;
+}
+
+// ───────────── File backend ─────────────
+
+typedef struct {
+    FILE *stream;
+    int fd;
+    uint8_t view[SECTOR_SIZE];  // Backs views when the sector cache is disabled
+} disk_file_t;
+
+static bool _disk_file_read(disk_t *disk, void *buffer, uint32_t first_sector, uint32_t count) {
+    disk_file_t *file = disk->context;
+    return sc_read(file->fd, buffer, first_sector, count);
+}
+
+static bool _disk_file_write(disk_t *disk, const void *buffer, uint32_t first_sector, uint32_t count) {
+    disk_file_t *file = disk->context;
+    return sc_write(file->fd, buffer, first_sector, count);
+}
+
+static bool _disk_file_flush(disk_t *disk) {
+    disk_file_t *file = disk->context;
+    if (!sc_flush(file->fd)) {
+        perror("Failed to flush sector cache");
+        return false;
+    }
+    return true;
+}
+
+static uint64_t _disk_file_size_op(disk_t *disk) {
+    disk_file_t *file = disk->context;
+    return _disk_file_size(file->stream);
+}
+
+static void _disk_file_close(disk_t *disk) {
+    disk_file_t *file = disk->context;
+    bd_release_direct(file->fd);
+    fclose(file->stream);
+    free(file);
+}
+
+static const uint8_t *_disk_file_view(disk_t *disk, uint32_t sector) {
+    disk_file_t *file = disk->context;
+    if (sc_is_enabled()) {
+        return sc_get(file->fd, sector);
+    }
+    if (!bd_read_sectors(file->fd, file->view, sector, 1)) return NULL;
+    return file->view;
+}
+
+// Every run is queued first and the whole batch is submitted at once
+static bool _disk_file_read_runs(disk_t *disk, const disk_run_t *runs, size_t n) {
+    disk_file_t *file = disk->context;
+    for (size_t i = 0; i < n; i++) {
+        iob_queue_read(file->fd, runs[i].buffer, runs[i].first_sector, runs[i].count);
+    }
+    if (!iob_submit_and_wait()) return false;
+
+    // The device may be behind the write-back cache
+    for (size_t i = 0; i < n; i++) {
+        sc_overlay_dirty(runs[i].buffer, runs[i].first_sector, runs[i].count);
+    }
+    return true;
+}
+
+static bool _disk_file_prefetch(disk_t *disk, const uint32_t *sectors, size_t n) {
+    disk_file_t *file = disk->context;
+    if (!sc_is_enabled()) return true;  // Sectors are read one by one anyway
+    return sc_prefetch(file->fd, sectors, n);
+}
+
+static bool _disk_file_advise(disk_t *disk, uint32_t first_sector, uint32_t count) {
+#ifdef _WIN32
+    UNUSED(disk);
+    UNUSED(first_sector);
+    UNUSED(count);
+    return false;
+#else
+    disk_file_t *file = disk->context;
+    if (bd_is_direct(file->fd)) return false;  // O_DIRECT skips the page cache, there is nothing to warm up
+    return posix_fadvise(file->fd, (off_t)first_sector * SECTOR_SIZE, (off_t)count * SECTOR_SIZE, POSIX_FADV_WILLNEED) == 0;
+#endif
+}
+
+static const disk_ops_t disk_file_ops = {
+    .name = "pread/pwrite",
+    .read_sectors = _disk_file_read,
+    .write_sectors = _disk_file_write,
+    .flush = _disk_file_flush,
+    .size = _disk_file_size_op,
+    .close = _disk_file_close,
+    .view_sector = _disk_file_view,
+    .read_runs = _disk_file_read_runs,
+    .prefetch = _disk_file_prefetch,
+    .advise = _disk_file_advise,
+};
+
+// Same operations, only the name differs so the mode shows up in the statistics
+static const disk_ops_t disk_direct_ops = {
+    .name = "pread/pwrite + O_DIRECT",
+    .read_sectors = _disk_file_read,
+    .write_sectors = _disk_file_write,
+    .flush = _disk_file_flush,
+    .size = _disk_file_size_op,
+    .close = _disk_file_close,
+    .view_sector = _disk_file_view,
+    .read_runs = _disk_file_read_runs,
+    .prefetch = _disk_file_prefetch,
+    .advise = _disk_file_advise,
+};
+
+disk_t *disk_open_file(const char *path, bool direct) {
+    assert(path != NULL);
+
+    FILE *stream = NULL;
+    if (direct) {
+        int fd = bd_open_direct(path);
+        if (fd < 0) return NULL;
+        stream = fdopen(fd, "r+b");
+        if (stream == NULL) {
+            int error = errno;
+            bd_release_direct(fd);
+            close(fd);
+            errno = error;
+            return NULL;
+        }
+    } else {
+        stream = fopen(path, "r+b");
+        if (stream == NULL) return NULL;
+    }
+
+    disk_file_t *file = malloc(sizeof(*file));
+    if (file == NULL) {
+        perror("malloc file backend");
+        bd_release_direct(fileno(stream));
+        fclose(stream);
+        return NULL;
+    }
+    file->stream = stream;
+    file->fd = fileno(stream);
+
+    disk_t *disk = disk_create(direct ? &disk_direct_ops : &disk_file_ops, file);
+    if (disk == NULL) _disk_file_close(&(disk_t){.context = file});
+    return disk;
+}
+
+// ───────────── mmap backend ─────────────
+
+// Context of the mmap and memory backends, the whole image is addressable at data
+typedef struct {
+    FILE *stream;  // mmap only, keeps the mapped file open
+    uint8_t *data;
+    uint64_t size;
+} disk_image_t;
+
+static bool _disk_image_read(disk_t *disk, void *buffer, uint32_t first_sector, uint32_t count) {
+    disk_image_t *image = disk->context;
+    if (!_disk_in_bounds(image->size, first_sector, count)) return false;
+    memcpy(buffer, image->data + (size_t)first_sector * SECTOR_SIZE, (size_t)count * SECTOR_SIZE);
+    return true;
+}
+
+static bool _disk_image_write(disk_t *disk, const void *buffer, uint32_t first_sector, uint32_t count) {
+    disk_image_t *image = disk->context;
+    if (!_disk_in_bounds(image->size, first_sector, count)) return false;
+    memcpy(image->data + (size_t)first_sector * SECTOR_SIZE, buffer, (size_t)count * SECTOR_SIZE);
+    return true;
+}
+
+static uint64_t _disk_image_size(disk_t *disk) {
+    disk_image_t *image = disk->context;
+    return image->size;
+}
+
+static const uint8_t *_disk_image_view(disk_t *disk, uint32_t sector) {
+    disk_image_t *image = disk->context;
+    if (!_disk_in_bounds(image->size, sector, 1)) return NULL;
+    return image->data + (size_t)sector * SECTOR_SIZE;
+}
+
+#ifndef _WIN32
+// Stores into the mapping are already visible to the image file, msync only happens on close
+static bool _disk_mmap_flush(disk_t *disk) {
+    UNUSED(disk);
+    return true;
+}
+
+static void _disk_mmap_close(disk_t *disk) {
+    disk_image_t *image = disk->context;
+    if (msync(image->data, image->size, MS_SYNC) != 0) {
+        perror("Failed to sync mapped disk image");
+    }
+    munmap(image->data, image->size);
+    fclose(image->stream);
+    free(image);
+}
+
+static bool _disk_mmap_advise(disk_t *disk, uint32_t first_sector, uint32_t count) {
+    disk_image_t *image = disk->context;
+    if (!_disk_in_bounds(image->size, first_sector, count)) return false;
+
+    // madvise wants a page aligned start
+    size_t offset = (size_t)first_sector * SECTOR_SIZE;
+    size_t aligned = offset - offset % (size_t)sysconf(_SC_PAGESIZE);
+    return madvise(image->data + aligned, (size_t)count * SECTOR_SIZE + (offset - aligned), MADV_WILLNEED) == 0;
+}
+
+static const disk_ops_t disk_mmap_ops = {
+    .name = "mmap",
+    .read_sectors = _disk_image_read,
+    .write_sectors = _disk_image_write,
+    .flush = _disk_mmap_flush,
+    .size = _disk_image_size,
+    .close = _disk_mmap_close,
+    .view_sector = _disk_image_view,
+    .advise = _disk_mmap_advise,
+};
+#endif
+
+disk_t *disk_open_mmap(const char *path) {
+    assert(path != NULL);
+
+#ifdef _WIN32
+    UNUSED(path);
+    fprintf(stderr, "Memory mapped volumes are not supported on Windows.\n");
+    return NULL;
+#else
+    FILE *stream = fopen(path, "r+b");
+    if (stream == NULL) return NULL;
+
+    uint64_t size = _disk_file_size(stream);
+    void *map = size > 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(stream), 0) : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        perror("Failed to map disk image");
+        fclose(stream);
+        return NULL;
+    }
+
+    disk_image_t *image = malloc(sizeof(*image));
+    if (image == NULL) {
+        perror("malloc mmap backend");
+        munmap(map, size);
+        fclose(stream);
+        return NULL;
+    }
+    *image = (disk_image_t){.stream = stream, .data = map, .size = size};
+
+    disk_t *disk = disk_create(&disk_mmap_ops, image);
+    if (disk == NULL) _disk_mmap_close(&(disk_t){.context = image});
+    return disk;
+#endif
+}
+
+// ───────────── Memory backend ─────────────
+
+static bool _disk_memory_flush(disk_t *disk) {
+    UNUSED(disk);
+    return true;  // Nothing behind the buffer
+}
+
+static void _disk_memory_close(disk_t *disk) {
+    disk_image_t *image = disk->context;
+    free(image->data);
+    free(image);
+}
+
+static const disk_ops_t disk_memory_ops = {
+    .name = "memoria",
+    .read_sectors = _disk_image_read,
+    .write_sectors = _disk_image_write,
+    .flush = _disk_memory_flush,
+    .size = _disk_image_size,
+    .close = _disk_memory_close,
+    .view_sector = _disk_image_view,
+};
+
+disk_t *disk_open_memory(const char *path) {
+    assert(path != NULL);
+
+    FILE *stream = fopen(path, "rb");
+    if (stream == NULL) return NULL;
+
+    uint64_t size = _disk_file_size(stream);
+    uint8_t *data = size > 0 ? malloc(size) : NULL;
+    if (data == NULL || fread(data, 1, size, stream) != size) {
+        perror("Failed to load disk image into memory");
+        free(data);
+        fclose(stream);
+        return NULL;
+    }
+    fclose(stream);
+
+    disk_image_t *image = malloc(sizeof(*image));
+    if (image == NULL) {
+        perror("malloc memory backend");
+        free(data);
+        return NULL;
+    }
+    *image = (disk_image_t){.stream = NULL, .data = data, .size = size};
+
+    disk_t *disk = disk_create(&disk_memory_ops, image);
+    if (disk == NULL) _disk_memory_close(&(disk_t){.context = image});
+    return disk;
+}
+
+// ───────────── Generic entry points ─────────────
+
+disk_t *disk_create(const disk_ops_t *ops, void *context) {
+    assert(ops != NULL);
+    assert(ops->read_sectors && ops->write_sectors && ops->flush && ops->size && ops->close);
+
+    disk_t *disk = malloc(sizeof(*disk));
+    if (disk == NULL) {
+        perror("malloc disk");
+        return NULL;
+    }
+    disk->ops = ops;
+    disk->context = context;
+    return disk;
+}
+
+void disk_close(disk_t *disk) {
+    if (disk == NULL) return;
+    disk->ops->close(disk);
+    free(disk);
+}
+
+const char *disk_name(const disk_t *disk) { return disk->ops->name; }
+
+bool disk_read_sectors(disk_t *disk, void *buffer, uint32_t first_sector, uint32_t count) {
+    return disk->ops->read_sectors(disk, buffer, first_sector, count);
+}
+
+bool disk_write_sectors(disk_t *disk, const void *buffer, uint32_t first_sector, uint32_t count) {
+    return disk->ops->write_sectors(disk, buffer, first_sector, count);
+}
+
+bool disk_flush(disk_t *disk) { return disk->ops->flush(disk); }
+
+uint64_t disk_size(disk_t *disk) { return disk->ops->size(disk); }
+
+const uint8_t *disk_view_sector(disk_t *disk, uint32_t sector) {
+    if (disk->ops->view_sector) {
+        return disk->ops->view_sector(disk, sector);
+    }
+
+    static uint8_t view[SECTOR_SIZE];
+    if (!disk->ops->read_sectors(disk, view, sector, 1)) return NULL;
+    return view;
+}
+
+bool disk_read_runs(disk_t *disk, const disk_run_t *runs, size_t n) {
+    if (disk->ops->read_runs) {
+        return disk->ops->read_runs(disk, runs, n);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (!disk->ops->read_sectors(disk, runs[i].buffer, runs[i].first_sector, runs[i].count)) return false;
+    }
+    return true;
+}
+
+bool disk_write_runs(disk_t *disk, const disk_run_t *runs, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (!disk->ops->write_sectors(disk, runs[i].buffer, runs[i].first_sector, runs[i].count)) return false;
+    }
+    return true;
+}
+
+bool disk_prefetch(disk_t *disk, const uint32_t *sectors, size_t n) {
+    if (disk->ops->prefetch == NULL || n == 0) return true;
+    return disk->ops->prefetch(disk, sectors, n);
+}
+
+bool disk_advise(disk_t *disk, uint32_t first_sector, uint32_t count) {
+    if (disk->ops->advise == NULL) return false;
+    return disk->ops->advise(disk, first_sector, count);
+}
@@ -1,17 +1,173 @@
 #include "fat12.h"
 
+#include "fat12_codec.h"
+
 #include "stb_ds.h"
 
 static bool has_loaded_fat_table = false;
 
-static uint8_t fat_table[SECTOR_SIZE * 9];  // FAT12 can have up to 9 sectors for the FAT table
+static uint8_t fat_table[SECTOR_SIZE * 9];  // FAT12 can have up to 9 sectors for the FAT table, packed 12-bit form
+static uint16_t fat_dirty_sectors = 0;      // Bit i set: FAT sector i changed since the last flush
+static uint8_t fat_copies = 1;              // FAT copies kept in step on every write (boot sector num_of_fats)
+
+// Decoded copy of fat_table, one entry per element. All lookups and updates use it,
+// fat_table is only re-packed from it right before sectors are written back.
+static uint16_t fat_entries[FAT12_FAT_TABLE_ENTRY_CAPACITY];
+
+// Free space map of the data clusters [FAT12_DATA_AREA_NUMBER_OFFSET, FAT12_MAX_CLUSTER_NUMBER), bit set = free.
+// Built when the table is loaded and kept in step by fat12_set_table_entry().
+#define FAT12_FREE_MAP_WORDS ((FAT12_FAT_TABLE_ENTRY_CAPACITY + 63) / 64)
+static uint64_t free_map[FAT12_FREE_MAP_WORDS];
+static uint32_t free_clusters = 0;
+
+// Runs of free clusters ordered by start, rebuilt from free_map on demand after the map changes.
+static fat12_extent_s *free_extents = NULL;
+static bool free_extents_stale = true;
+
+static fat12_alloc_policy_e alloc_policy = FAT12_ALLOC_BEST_FIT;
+static uint16_t next_fit_cursor = FAT12_DATA_AREA_NUMBER_OFFSET;  // Where next-fit resumes, end of the last run handed out
+
+// Chain cache: first cluster -> the chain as runs, plus the chain index each run starts at for "Nth cluster" lookups.
+// chain_owner[c] is the first cluster of the cached chain holding c (0 = none), so a change to any member drops
+// exactly the chains it belongs to.
+typedef struct {
+    fat12_extent_s *extents;
+    uint32_t *run_offsets;  // run_offsets[i]: position in the chain of extents[i].start
+    uint32_t length;        // Clusters in the chain
+} fat12_cached_chain_s;
+
+static struct {
+    uint16_t key;
+    fat12_cached_chain_s value;
+} *chain_cache = NULL;
+static uint16_t chain_owner[FAT12_FAT_TABLE_ENTRY_CAPACITY];
+static fat12_chain_cache_stats_s chain_cache_stats = {0};
+
+// Metadata transaction: directory sectors changed by fat12_write_directory() are staged here and FAT flushes
+// are held back until the outermost commit writes both in one ordered batch. The entries are snapshot at
+// begin so abort can roll the table back.
+typedef struct {
+    uint8_t data[SECTOR_SIZE];
+    uint8_t original[SECTOR_SIZE];  // Image contents at staging time, written back if the commit fails halfway
+} fat12_staged_sector_s;
+
+static struct {
+    uint32_t key;
+    fat12_staged_sector_s value;
+} *txn_sectors = NULL;
+static uint32_t txn_depth = 0;
+static uint16_t txn_saved_entries[FAT12_FAT_TABLE_ENTRY_CAPACITY];
+static uint16_t txn_saved_dirty_sectors = 0;
+static bool txn_aborted = false;  // An inner transaction aborted, the outermost commit must fail
+
+static bool fat12_is_data_cluster(uint32_t cluster) {
+    return cluster >= FAT12_DATA_AREA_NUMBER_OFFSET && cluster < (FAT12_MAX_CLUSTER_NUMBER);
+}
 
-static void fat12_reset_file_seek(FILE *disk) {
-    assert(disk != NULL);
-    if (fseek(disk, 0, SEEK_SET) != 0) {
-        perror("Failed to reset file seek");
-        exit(EXIT_FAILURE);
+static void fat12_build_free_map(void) {
+    memset(free_map, 0, sizeof(free_map));
+    free_clusters = 0;
+    for (uint32_t cluster = FAT12_DATA_AREA_NUMBER_OFFSET; cluster < (FAT12_MAX_CLUSTER_NUMBER); cluster++) {
+        if (fat_entries[cluster] == FAT12_FREE) {
+            free_map[cluster / 64] |= 1ULL << (cluster % 64);
+        }
     }
+    for (uint32_t word = 0; word < FAT12_FREE_MAP_WORDS; word++) {
+        free_clusters += __builtin_popcountll(free_map[word]);
+    }
+    free_extents_stale = true;
+}
+
+static void fat12_build_free_extents(void) {
+    arrfree(free_extents);
+    for (uint32_t cluster = FAT12_DATA_AREA_NUMBER_OFFSET; cluster < (FAT12_MAX_CLUSTER_NUMBER);) {
+        // Skip used clusters, then measure the free run, a word at a time where possible
+        uint64_t free_bits = free_map[cluster / 64] >> (cluster % 64);
+        if (free_bits == 0) {
+            cluster = (cluster / 64 + 1) * 64;
+            continue;
+        }
+        cluster += __builtin_ctzll(free_bits);
+        if (cluster >= (FAT12_MAX_CLUSTER_NUMBER)) break;
+
+        uint32_t end = cluster;
+        while (end < (FAT12_MAX_CLUSTER_NUMBER)) {
+            uint64_t used_bits = ~free_map[end / 64] >> (end % 64);
+            if (used_bits != 0) {
+                end += __builtin_ctzll(used_bits);
+                break;
+            }
+            end = (end / 64 + 1) * 64;
+        }
+        if (end > (FAT12_MAX_CLUSTER_NUMBER)) end = (FAT12_MAX_CLUSTER_NUMBER);
+
+        fat12_extent_s run = {.start = cluster, .length = end - cluster};
+        arrpush(free_extents, run);
+        cluster = end;
+    }
+    free_extents_stale = false;
+}
+
+static void fat12_free_cached_chain(fat12_cached_chain_s *chain) {
+    arrfree(chain->extents);
+    arrfree(chain->run_offsets);
+}
+
+static void fat12_evict_chain(uint16_t first_cluster) {
+    ptrdiff_t slot = hmgeti(chain_cache, first_cluster);
+    if (slot < 0) return;
+
+    fat12_cached_chain_s *chain = &chain_cache[slot].value;
+    for (int i = 0; i < arrlen(chain->extents); i++) {
+        for (uint16_t c = 0; c < chain->extents[i].length; c++) {
+            chain_owner[chain->extents[i].start + c] = 0;
+        }
+    }
+    fat12_free_cached_chain(chain);
+    (void)hmdel(chain_cache, first_cluster);
+    chain_cache_stats.invalidations++;
+}
+
+static void fat12_clear_chain_cache(void) {
+    for (int i = 0; i < hmlen(chain_cache); i++) {
+        fat12_free_cached_chain(&chain_cache[i].value);
+    }
+    hmfree(chain_cache);
+    memset(chain_owner, 0, sizeof(chain_owner));
+}
+
+// Every 3 packed bytes hold a pair of entries: even = byte0 | (byte1 & 0x0F) << 8, odd = byte1 >> 4 | byte2 << 4
+static void fat12_decode_table(void) {
+    f12c_unpack(fat_table, fat_entries, FAT12_FAT_TABLE_ENTRY_CAPACITY / 2);
+}
+
+// Re-packs the entry pairs that have at least one byte in FAT sectors [first_sector, first_sector + count).
+static void fat12_encode_sectors(uint32_t first_sector, uint32_t count) {
+    uint32_t first_pair = first_sector * SECTOR_SIZE / 3;
+    uint32_t end_pair = ((first_sector + count) * SECTOR_SIZE + 2) / 3;
+    if (end_pair > FAT12_FAT_TABLE_ENTRY_CAPACITY / 2) end_pair = FAT12_FAT_TABLE_ENTRY_CAPACITY / 2;
+    if (first_pair >= end_pair) return;
+
+    f12c_pack(fat_entries + first_pair * 2, fat_table + first_pair * 3, end_pair - first_pair);
+}
+
+// Absolute sector number of a data area cluster (clusters are numbered from 2)
+static uint32_t fat12_cluster_to_sector(uint16_t cluster) {
+    return FAT12_DATA_AREA_START + (cluster - FAT12_DATA_AREA_NUMBER_OFFSET);
+}
+
+// Directory sectors are read through the transaction's staged copy when there is one
+static const uint8_t *fat12_view_metadata_sector(disk_t *disk, uint32_t sector) {
+    ptrdiff_t slot = hmgeti(txn_sectors, sector);
+    return slot >= 0 ? txn_sectors[slot].value.data : disk_view_sector(disk, sector);
+}
+
+static bool fat12_read_sectors(disk_t *disk, void *buffer, uint32_t first_sector, uint32_t count) {
+    return disk_read_sectors(disk, buffer, first_sector, count);
+}
+
+static bool fat12_write_sectors(disk_t *disk, const void *buffer, uint32_t first_sector, uint32_t count) {
+    return disk_write_sectors(disk, buffer, first_sector, count);
 }
 
 fat12_time_s fat12_extract_time(uint16_t time) {
@@ -34,141 +190,164 @@ fat12_date_s fat12_extract_date(uint16_t date) {
     return d;
 }
 
-fat12_boot_sector_s fat12_read_boot_sector(FILE *disk) {
+fat12_boot_sector_s fat12_read_boot_sector(disk_t *disk) {
     assert(disk != NULL);
-    fat12_reset_file_seek(disk);
 
+    uint8_t sector[SECTOR_SIZE];
     fat12_boot_sector_s boot_sector;
 
     // Read the boot sector into the structure
-    size_t bytes_read = fread(&boot_sector, sizeof(fat12_boot_sector_s), 1, disk);
-    if (bytes_read != 1) {
+    if (!fat12_read_sectors(disk, sector, 0, 1)) {
         perror("Failed to read boot sector");
         exit(EXIT_FAILURE);
     }
+    memcpy(&boot_sector, sector, sizeof(boot_sector));
 
     return boot_sector;
 }
 
-fat12_file_subdir_s fat12_read_directory_entry(FILE *disk, uint16_t entry_idx) {
+const fat12_file_subdir_s *fat12_view_directory_entry(disk_t *disk, uint16_t entry_idx) {
     assert(disk != NULL);
     assert(entry_idx < (FAT12_NUM_OF_ROOT_DIRECTORY_SECTORS * FAT12_DIRECTORY_ENTRIES_PER_SECTOR));
-    fat12_reset_file_seek(disk);
-
-    fat12_file_subdir_s dir_entry;
 
     // Calculate the sector where the directory entry is located
     uint16_t sector_idx = FAT12_ROOT_DIRECTORY_START + (entry_idx / FAT12_DIRECTORY_ENTRIES_PER_SECTOR);
     uint16_t entry_offset = entry_idx % FAT12_DIRECTORY_ENTRIES_PER_SECTOR;
 
-    // Move to the position of the directory entry
-    if (fseek(disk, sector_idx * SECTOR_SIZE + entry_offset * sizeof(fat12_file_subdir_s), SEEK_SET) != 0) {
-        perror("Failed to seek to directory entry position");
-        exit(EXIT_FAILURE);
-    }
-
-    // Read the directory entry into the structure
-    size_t bytes_read = fread(&dir_entry, sizeof(fat12_file_subdir_s), 1, disk);
-    if (bytes_read != 1) {
+    const uint8_t *sector = fat12_view_metadata_sector(disk, sector_idx);
+    if (sector == NULL) {
         perror("Failed to read directory entry");
         exit(EXIT_FAILURE);
     }
 
-    return dir_entry;
+    return (const fat12_file_subdir_s *)(sector + entry_offset * sizeof(fat12_file_subdir_s));
+}
+
+fat12_file_subdir_s fat12_read_directory_entry(disk_t *disk, uint16_t entry_idx) {
+    return *fat12_view_directory_entry(disk, entry_idx);
 }
 
-fat12_file_subdir_s fat12_read_directory_from_data_area(FILE *disk, uint16_t cluster, uint8_t idx) {
+const fat12_file_subdir_s *fat12_view_directory_from_data_area(disk_t *disk, uint16_t cluster, uint8_t idx) {
     assert(disk != NULL);
     assert(cluster < FAT12_MAX_CLUSTER_NUMBER);
     assert(idx < FAT12_DIRECTORY_ENTRIES_PER_SECTOR);
-    fat12_reset_file_seek(disk);
 
-    fat12_file_subdir_s dir_entry;
+    const uint8_t *sector = fat12_view_metadata_sector(disk, fat12_cluster_to_sector(cluster));
+    if (sector == NULL) {
+        perror("Failed to read directory entry from sector");
+        exit(EXIT_FAILURE);
+    }
 
-    const uint64_t offset = ((FAT12_DATA_AREA_START + (cluster - FAT12_DATA_AREA_NUMBER_OFFSET)) * SECTOR_SIZE) + (idx * sizeof(fat12_file_subdir_s));
+    return (const fat12_file_subdir_s *)(sector + idx * sizeof(fat12_file_subdir_s));
+}
 
-    // Move to the start of the directory sector
-    if (fseek(disk, offset, SEEK_SET) != 0) {
-        perror("Failed to seek to directory sector position");
-        exit(EXIT_FAILURE);
+fat12_file_subdir_s fat12_read_directory_from_data_area(disk_t *disk, uint16_t cluster, uint8_t idx) {
+    return *fat12_view_directory_from_data_area(disk, cluster, idx);
+}
+
+bool fat12_read_root_directory(disk_t *disk, fat12_file_subdir_s *entries) {
+    assert(disk != NULL);
+    assert(entries != NULL);
+
+    if (!fat12_read_sectors(disk, entries, FAT12_ROOT_DIRECTORY_START, FAT12_NUM_OF_ROOT_DIRECTORY_SECTORS)) {
+        perror("Failed to read root directory");
+        return false;
     }
 
-    // Read the directory entry into the structure
-    size_t bytes_read = fread(&dir_entry, sizeof(fat12_file_subdir_s), 1, disk);
-    if (bytes_read != 1) {
-        perror("Failed to read directory entry from sector");
-        exit(EXIT_FAILURE);
+    // Sectors changed by the open transaction win over the image
+    for (int i = 0; i < hmlen(txn_sectors); i++) {
+        uint32_t sector = txn_sectors[i].key;
+        if (sector >= FAT12_ROOT_DIRECTORY_START &&
+            sector < FAT12_ROOT_DIRECTORY_START + FAT12_NUM_OF_ROOT_DIRECTORY_SECTORS) {
+            memcpy((uint8_t *)entries + (sector - FAT12_ROOT_DIRECTORY_START) * SECTOR_SIZE, txn_sectors[i].value.data,
+                   SECTOR_SIZE);
+        }
     }
 
-    return dir_entry;
+    return true;
+}
+
+const fat12_file_subdir_s *fat12_view_directory_cluster(disk_t *disk, uint16_t cluster) {
+    return fat12_view_directory_from_data_area(disk, cluster, 0);
+}
+
+fat12_file_subdir_s fat12_deleted_entry(fat12_file_subdir_s entry) {
+    entry.filename[0] = (char)FAT12_ENTRY_DELETED;
+    return entry;
 }
 
 // If cluster is 0, it will write to the root directory.
 bool fat12_write_directory(
-    FILE *disk,
+    disk_t *disk,
     uint16_t cluster,
     uint8_t idx,
     fat12_file_subdir_s entry) {
     assert(disk != NULL);
     assert(cluster < FAT12_MAX_CLUSTER_NUMBER);
     assert(idx < FAT12_DIRECTORY_ENTRIES_PER_SECTOR);
-    fat12_reset_file_seek(disk);
 
     printf("Writing directory entry at cluster %u, index %u\n", cluster, idx);
 
-    const uint64_t offset = cluster > 0
-                                ? ((FAT12_DATA_AREA_START + (cluster - FAT12_DATA_AREA_NUMBER_OFFSET)) * SECTOR_SIZE) + (idx * sizeof(fat12_file_subdir_s))
-                                : (FAT12_ROOT_DIRECTORY_START * SECTOR_SIZE) + (idx * sizeof(fat12_file_subdir_s));
-    // Move to the start of the directory sector
+    const uint32_t sector_idx = cluster > 0
+                                    ? fat12_cluster_to_sector(cluster)
+                                    : FAT12_ROOT_DIRECTORY_START;
+
+    if (txn_depth > 0) {
+        // Staged, reaches the disk on commit
+        ptrdiff_t slot = hmgeti(txn_sectors, sector_idx);
+        if (slot < 0) {
+            fat12_staged_sector_s staged;
+            if (!fat12_read_sectors(disk, staged.data, sector_idx, 1)) {
+                perror("Failed to read directory sector");
+                return false;
+            }
+            memcpy(staged.original, staged.data, SECTOR_SIZE);
+            hmput(txn_sectors, sector_idx, staged);
+            slot = hmgeti(txn_sectors, sector_idx);
+        }
+        memcpy(txn_sectors[slot].value.data + idx * sizeof(fat12_file_subdir_s), &entry, sizeof(entry));
+        return true;
+    }
 
-    if (fseek(disk, offset, SEEK_SET) != 0) {
-        perror("Failed to seek to directory sector position");
-        return false;  // Return false if the seek failed
+    // Entries are smaller than a sector, so read-modify-write the sector holding it
+    uint8_t sector[SECTOR_SIZE];
+    if (!fat12_read_sectors(disk, sector, sector_idx, 1)) {
+        perror("Failed to read directory sector");
+        return false;  // Return false if the read failed
     }
+
+    memcpy(sector + idx * sizeof(fat12_file_subdir_s), &entry, sizeof(entry));
+
     // Write the directory entry to the disk
-    size_t bytes_written = fwrite(&entry, sizeof(fat12_file_subdir_s), 1, disk);
-    if (bytes_written != 1) {
+    if (!fat12_write_sectors(disk, sector, sector_idx, 1)) {
         perror("Failed to write directory entry to sector");
         return false;  // Return false if the write failed
     }
 
-    // Flush the disk to ensure the data is written
-    if (fflush(disk) != 0) {
-        perror("Failed to flush disk after writing directory entry");
-        return false;  // Return false if the write failed
-    }
-
     return true;  // Return the written entry
 }
 
-fat12_dir_entry_s fat12_allocate_entry_in_directory(FILE *disk, uint16_t cluster) {
+fat12_dir_entry_s fat12_allocate_entry_in_directory(disk_t *disk, uint16_t cluster) {
     // TODO: Implement the logic to allocate a directory entry in the root directory or in a subdirectory.
     // If the cluster is 0, it will allocate in the root directory.
     // If the cluster is not 0, it will allocate in the subdirectory, if that is full it will extend the directory chain.
 
     assert(disk != NULL);
     assert(cluster < FAT12_MAX_CLUSTER_NUMBER);
-    fat12_reset_file_seek(disk);
     fat12_dir_entry_s entry = {0};
     // Find the next free entry in the directory
     for (uint16_t i = 0; i < FAT12_DIRECTORY_ENTRIES_PER_SECTOR; i++) {
-        if (cluster == 0) {
-            // If cluster is 0, we are in the root directory
-            fat12_file_subdir_s dir_entry = fat12_read_directory_entry(disk, i);
-            if (dir_entry.filename[0] == 0x00 || dir_entry.filename[0] == 0xE5) {  // Empty or deleted entry
-                entry.cluster = 0;                                                 // Root directory
-                entry.idx = i;
-                return entry;  // Return the first free entry found
-            }
-        } else {
-            fat12_file_subdir_s dir_entry = fat12_read_directory_from_data_area(disk, cluster, i);
-            if (dir_entry.filename[0] == 0x00 || dir_entry.filename[0] == 0xE5) {  // Empty or deleted entry
-                entry.cluster = cluster;
-                entry.idx = i;
-                return entry;  // Return the first free entry found
-            }
+        const fat12_file_subdir_s *dir_entry = cluster == 0
+                                                   ? fat12_view_directory_entry(disk, i)  // If cluster is 0, we are in the root directory
+                                                   : fat12_view_directory_from_data_area(disk, cluster, i);
+        if (dir_entry->filename[0] == FAT12_ENTRY_END || (uint8_t)dir_entry->filename[0] == FAT12_ENTRY_DELETED) {
+            entry.cluster = cluster;
+            entry.idx = i;
+            return entry;  // Return the first free entry found
         }
     }
+
+    return entry;  // No free entry, {0, 0} signals the failure
 }
 
 char *fat12_attribute_to_string(uint8_t attribute) {
@@ -244,204 +423,735 @@ void fat12_print_directory_info(fat12_file_subdir_s dir) {
 }
 
 // Reads a cluster from a FAT12 disk image and overwrites the provided buffer with the cluster data.
-uint8_t *fat12_read_data_sector(FILE *disk, uint8_t *buffer, uint16_t sector_number) {
+uint8_t *fat12_read_data_sector(disk_t *disk, uint8_t *buffer, uint16_t sector_number) {
     assert(disk != NULL);
     assert(buffer != NULL);
     assert(sector_number < FAT12_MAX_CLUSTER_NUMBER);
-    fat12_reset_file_seek(disk);
-
-    // Calculate the offset for the cluster
-    uint64_t offset = (FAT12_DATA_AREA_START + (sector_number - FAT12_DATA_AREA_NUMBER_OFFSET)) * SECTOR_SIZE;
 
-    if (fseek(disk, offset, SEEK_SET) != 0) {
-        perror("Failed to seek to cluster position");
+    if (!fat12_read_sectors(disk, buffer, fat12_cluster_to_sector(sector_number), 1)) {
+        perror("Failed to read cluster data");
         return NULL;
     }
 
-    size_t bytes_read = fread(buffer, sizeof(uint8_t), SECTOR_SIZE, disk);
-    if (bytes_read != SECTOR_SIZE) {
+    return buffer;
+}
+
+const uint8_t *fat12_view_data_sector(disk_t *disk, uint16_t sector_number) {
+    assert(disk != NULL);
+    assert(sector_number < FAT12_MAX_CLUSTER_NUMBER);
+
+    const uint8_t *sector = disk_view_sector(disk, fat12_cluster_to_sector(sector_number));
+    if (sector == NULL) {
         perror("Failed to read cluster data");
-        return NULL;
     }
 
-    return buffer;
+    return sector;
 }
 
-bool fat12_write_data_sector(FILE *disk, uint8_t *buffer, uint16_t sector_number) {
+bool fat12_write_data_sector(disk_t *disk, uint8_t *buffer, uint16_t sector_number) {
     assert(disk != NULL);
     assert(buffer != NULL);
     assert(sector_number < FAT12_MAX_CLUSTER_NUMBER);
-    fat12_reset_file_seek(disk);
-
-    // Calculate the offset for the cluster
-    uint64_t offset = (FAT12_DATA_AREA_START + (sector_number - FAT12_DATA_AREA_NUMBER_OFFSET)) * SECTOR_SIZE;
 
-    if (fseek(disk, offset, SEEK_SET) != 0) {
-        perror("Failed to seek to cluster position");
+    if (!fat12_write_sectors(disk, buffer, fat12_cluster_to_sector(sector_number), 1)) {
+        perror("Failed to write cluster data");
         return false;
     }
 
-    size_t bytes_written = fwrite(buffer, sizeof(uint8_t), SECTOR_SIZE, disk);
-    if (bytes_written != SECTOR_SIZE) {
-        perror("Failed to write cluster data");
+    return true;
+}
+
+bool fat12_write_data_clusters(disk_t *disk, const uint8_t *buffer, uint16_t first_cluster, uint16_t count) {
+    assert(disk != NULL);
+    assert(buffer != NULL);
+    assert(first_cluster >= FAT12_DATA_AREA_NUMBER_OFFSET);
+    assert(first_cluster + count <= (FAT12_MAX_CLUSTER_NUMBER));
+
+    if (!fat12_write_sectors(disk, buffer, fat12_cluster_to_sector(first_cluster), count)) {
+        perror("Failed to write cluster run");
         return false;
     }
 
     return true;
 }
 
-uint8_t *fat12_load_full_fat_table(FILE *disk) {
+void fat12_chain_to_extents(const uint16_t *chain, size_t chain_length, fat12_extent_s **extents) {
+    assert(extents != NULL);
+
+    for (size_t i = 0; i < chain_length; i++) {
+        size_t last = arrlen(*extents);
+        if (last > 0) {
+            fat12_extent_s *run = &(*extents)[last - 1];
+            if (run->start + run->length == chain[i]) {
+                run->length++;
+                continue;
+            }
+        }
+        fat12_extent_s run = {.start = chain[i], .length = 1};
+        arrpush(*extents, run);
+    }
+}
+
+bool fat12_read_cluster_chain(disk_t *disk, const uint16_t *chain, size_t chain_length, uint8_t *buffer) {
     assert(disk != NULL);
-    fat12_reset_file_seek(disk);
+    assert(buffer != NULL);
 
-    // Move to the start of the FAT table
-    if (fseek(disk, SECTOR_SIZE * FAT12_FAT_TABLES_START, SEEK_SET) != 0) {
-        perror("Failed to seek to FAT table position");
-        return NULL;
+    fat12_extent_s *extents = NULL;
+    fat12_chain_to_extents(chain, chain_length, &extents);
+
+    // One run per extent, the backend may submit them all at once
+    disk_run_t *runs = malloc((arrlen(extents) + 1) * sizeof(*runs));
+    if (!runs) {
+        perror("malloc cluster runs");
+        arrfree(extents);
+        return false;
+    }
+
+    uint8_t *cursor = buffer;
+    for (int i = 0; i < arrlen(extents); i++) {
+        assert(extents[i].start + extents[i].length <= FAT12_MAX_CLUSTER_NUMBER);
+        runs[i] = (disk_run_t){.buffer = cursor, .first_sector = fat12_cluster_to_sector(extents[i].start), .count = extents[i].length};
+        cursor += (size_t)extents[i].length * SECTOR_SIZE;
+    }
+
+    bool ok = disk_read_runs(disk, runs, arrlen(extents));
+    free(runs);
+
+    if (!ok) {
+        perror("Failed to read cluster run");
+    }
+
+    arrfree(extents);
+    return ok;
+}
+
+bool fat12_prefetch_clusters(disk_t *disk, const uint16_t *clusters, size_t count) {
+    assert(disk != NULL);
+
+    if (count == 0) return true;
+
+    uint32_t *sectors = malloc(count * sizeof(*sectors));
+    if (!sectors) {
+        perror("malloc prefetch sectors");
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        sectors[i] = fat12_cluster_to_sector(clusters[i]);
     }
 
+    bool ok = disk_prefetch(disk, sectors, count);
+    free(sectors);
+    return ok;
+}
+
+size_t fat12_advise_clusters(disk_t *disk, const uint16_t *clusters, size_t count) {
+    assert(disk != NULL);
+
+    fat12_extent_s *extents = NULL;
+    fat12_chain_to_extents(clusters, count, &extents);
+
+    size_t advised = 0;
+    for (int i = 0; i < arrlen(extents); i++) {
+        if (disk_advise(disk, fat12_cluster_to_sector(extents[i].start), extents[i].length)) advised++;
+    }
+
+    arrfree(extents);
+    return advised;
+}
+
+uint8_t *fat12_load_full_fat_table(disk_t *disk) {
+    assert(disk != NULL);
+
     // Clear the FAT table buffer
     memset(fat_table, 0, sizeof(fat_table));
 
     // Read the FAT table into the buffer
-    size_t bytes_read = fread(fat_table, sizeof(uint8_t), SECTOR_SIZE * FAT12_NUM_OF_FAT_TABLES_SECTORS, disk);
-    if (bytes_read != SECTOR_SIZE * FAT12_NUM_OF_FAT_TABLES_SECTORS) {
+    if (!fat12_read_sectors(disk, fat_table, FAT12_FAT_TABLES_START, FAT12_NUM_OF_FAT_TABLES_SECTORS)) {
         perror("Failed to read FAT table data");
         return NULL;
     }
 
+    // Every copy is rewritten from copy #1, as long as the copies have the layout the rest of the code assumes
+    fat12_boot_sector_s boot_sector = fat12_read_boot_sector(disk);
+    fat_copies = boot_sector.num_of_fats;
+    if (boot_sector.sectors_per_fat != FAT12_NUM_OF_FAT_TABLES_SECTORS || fat_copies == 0 ||
+        fat_copies > FAT12_MAX_FAT_COPIES) {
+        fprintf(stderr, "Unexpected FAT layout (%u copies of %u sectors), only FAT #1 will be written.\n",
+                boot_sector.num_of_fats, boot_sector.sectors_per_fat);
+        fat_copies = 1;
+    }
+
+    fat12_decode_table();
+    fat12_build_free_map();
+    fat12_clear_chain_cache();
+    next_fit_cursor = FAT12_DATA_AREA_NUMBER_OFFSET;
     has_loaded_fat_table = true;  // Mark that the FAT table has been loaded
+    fat_dirty_sectors = 0;
 
     return fat_table;
 }
-bool fat12_write_full_fat_table(FILE *disk) {
+// Writes FAT sectors [first, first + count) of the packed table to the same place in every FAT copy, as one request
+static bool fat12_write_fat_sectors(disk_t *disk, uint32_t first, uint32_t count) {
+    disk_run_t runs[FAT12_MAX_FAT_COPIES];
+    for (uint32_t copy = 0; copy < fat_copies; copy++) {
+        runs[copy] = (disk_run_t){
+            .buffer = fat_table + first * SECTOR_SIZE,
+            .first_sector = FAT12_FAT_TABLES_START + copy * FAT12_NUM_OF_FAT_TABLES_SECTORS + first,
+            .count = count,
+        };
+    }
+    return disk_write_runs(disk, runs, fat_copies);
+}
+
+bool fat12_write_full_fat_table(disk_t *disk) {
     assert(disk != NULL);
     assert(has_loaded_fat_table);
-    fat12_reset_file_seek(disk);
-
-    // Move to the start of the FAT table
-    if (fseek(disk, SECTOR_SIZE * FAT12_FAT_TABLES_START, SEEK_SET) != 0) {
-        perror("Failed to seek to FAT table position");
-        return false;
-    }
 
     // Write the FAT table to the disk
-    size_t bytes_written = fwrite(fat_table, sizeof(uint8_t), SECTOR_SIZE * FAT12_NUM_OF_FAT_TABLES_SECTORS, disk);
-    if (bytes_written != SECTOR_SIZE * FAT12_NUM_OF_FAT_TABLES_SECTORS) {
+    fat12_encode_sectors(0, FAT12_NUM_OF_FAT_TABLES_SECTORS);
+    if (!fat12_write_fat_sectors(disk, 0, FAT12_NUM_OF_FAT_TABLES_SECTORS)) {
         perror("Failed to write FAT table data");
         return false;
     }
 
+    fat_dirty_sectors = 0;
     return true;  // Return true if the write was successful
 }
 
-// Reads a FAT12 table entry.
-uint16_t fat12_get_table_entry(uint16_t entry_idx) {
+static bool fat12_write_dirty_fat_sectors(disk_t *disk) {
+    // One write per run of consecutive dirty sectors
+    for (uint32_t first = 0; first < FAT12_NUM_OF_FAT_TABLES_SECTORS; first++) {
+        if (!(fat_dirty_sectors & (1u << first))) continue;
+
+        uint32_t count = 1;
+        while (first + count < FAT12_NUM_OF_FAT_TABLES_SECTORS && (fat_dirty_sectors & (1u << (first + count)))) {
+            count++;
+        }
+
+        fat12_encode_sectors(first, count);
+        if (!fat12_write_fat_sectors(disk, first, count)) {
+            perror("Failed to write FAT table data");
+            return false;  // The sectors not written yet stay dirty
+        }
+        fat_dirty_sectors &= ~(((1u << count) - 1) << first);
+        first += count;
+    }
+
+    return true;
+}
+
+bool fat12_flush_fat_table(disk_t *disk) {
+    assert(disk != NULL);
     assert(has_loaded_fat_table);
-    assert(entry_idx < 0xFFF);
-    assert(fat_table != NULL);
 
-    // Compute byte offset = floor(entry_idx * 1.5)
-    uint32_t byte_offset = (entry_idx * 3) / 2;
+    if (txn_depth > 0) return true;  // Written by the commit
+    return fat12_write_dirty_fat_sectors(disk);
+}
+
+void fat12_begin_transaction(void) {
+    assert(has_loaded_fat_table);
+
+    if (txn_depth++ > 0) return;  // Nested, joins the outer transaction
+    memcpy(txn_saved_entries, fat_entries, sizeof(fat_entries));
+    txn_saved_dirty_sectors = fat_dirty_sectors;
+}
+
+bool fat12_in_transaction(void) { return txn_depth > 0; }
+
+static int fat12_compare_sector(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void fat12_drop_staged_sectors(void) {
+    hmfree(txn_sectors);
+}
 
-    uint16_t value = 0;
-    if ((entry_idx % 2) == 0) {
-        // If entry_idx is even, the first byte contains the low 8 bits
-        // and the second byte contains the high 4 bits.
-        uint16_t lo = fat_table[byte_offset];
-        uint16_t hi = fat_table[byte_offset + 1] & 0x0F;
-        value = lo | (hi << 8);
+static void fat12_rollback_transaction(void) {
+    fat12_drop_staged_sectors();
+    memcpy(fat_entries, txn_saved_entries, sizeof(fat_entries));
+    fat_dirty_sectors = txn_saved_dirty_sectors;
+    fat12_build_free_map();
+    fat12_clear_chain_cache();
+}
+
+// Undoes a commit that failed after written_count of the sorted staged sectors may have reached the image:
+// the in-memory state is rolled back as on abort, then those directory sectors get their old contents back
+// and the FAT sectors the transaction touched are rewritten from the restored entries.
+static bool fat12_undo_commit(disk_t *disk, uint16_t touched_fat_sectors, const uint32_t *sectors,
+                              int written_count) {
+    bool restored = true;
+    // Directory sectors first, so no restored entry is left pointing at clusters the old FAT does not link
+    for (int i = 0; i < written_count; i++) {
+        if (!fat12_write_sectors(disk, hmget(txn_sectors, sectors[i]).original, sectors[i], 1)) {
+            restored = false;
+        }
+    }
+
+    fat12_rollback_transaction();
+    fat_dirty_sectors |= touched_fat_sectors;
+    if (!fat12_write_dirty_fat_sectors(disk)) {
+        restored = false;  // They stay dirty, the next flush tries again
+    }
+
+    if (!restored) {
+        fprintf(stderr, "Failed to restore the image after a failed commit, it may be partly written.\n");
+    }
+    return restored;
+}
+
+bool fat12_commit_transaction(disk_t *disk) {
+    assert(disk != NULL);
+    assert(txn_depth > 0);
+
+    if (--txn_depth > 0) return !txn_aborted;  // The outermost commit writes
+    if (txn_aborted) {
+        fat12_rollback_transaction();  // Undo what ran after the inner abort too
+        txn_aborted = false;
+        return false;
+    }
+
+    // Every dirty sector may be written, including those already dirty at begin: all of them are rewritten on undo
+    uint16_t touched_fat_sectors = fat_dirty_sectors;
+
+    // FAT first, so no directory entry ever points at clusters the table does not link yet
+    if (!fat12_write_dirty_fat_sectors(disk)) {
+        fat12_undo_commit(disk, touched_fat_sectors, NULL, 0);
+        return false;
+    }
+
+    uint32_t *sectors = NULL;
+    for (int i = 0; i < hmlen(txn_sectors); i++) {
+        arrpush(sectors, txn_sectors[i].key);
+    }
+    qsort(sectors, arrlen(sectors), sizeof(uint32_t), fat12_compare_sector);
+
+    // Directory sectors in disk order, one write per run of consecutive sectors
+    bool ok = true;
+    uint8_t *run = NULL;
+    int attempted = 0;  // Sectors that may be on the image, the failed run included
+    while (attempted < arrlen(sectors) && ok) {
+        int first = attempted;
+        int count = 1;
+        while (first + count < arrlen(sectors) && sectors[first + count] == sectors[first] + count) {
+            count++;
+        }
+
+        arrsetlen(run, count * SECTOR_SIZE);
+        for (int j = 0; j < count; j++) {
+            memcpy(run + j * SECTOR_SIZE, hmget(txn_sectors, sectors[first + j]).data, SECTOR_SIZE);
+        }
+        attempted += count;
+        if (!fat12_write_sectors(disk, run, sectors[first], count)) {
+            perror("Failed to write directory sectors");
+            ok = false;
+        }
+    }
+    arrfree(run);
+
+    if (!ok) {
+        fat12_undo_commit(disk, touched_fat_sectors, sectors, attempted);
     } else {
-        // If entry_idx is odd, the first byte contains the low 4 bits
-        // and the second byte contains the high 8 bits.
-        uint16_t lo = (fat_table[byte_offset] >> 4) & 0x0F;
-        uint16_t hi = fat_table[byte_offset + 1];
-        value = (lo) | (hi << 4);
+        fat12_drop_staged_sectors();
+    }
+    arrfree(sectors);
+    return ok;
+}
+
+void fat12_abort_transaction(void) {
+    assert(txn_depth > 0);
+
+    fat12_rollback_transaction();
+    if (--txn_depth > 0) txn_aborted = true;
+}
+
+uint8_t fat12_count_fat_copies(void) { return fat_copies; }
+
+bool fat12_verify_fat_copies(disk_t *disk, uint8_t copies, fat12_fat_mismatch_s **mismatches) {
+    assert(disk != NULL);
+    assert(mismatches != NULL);
+    assert(copies >= 1 && copies <= FAT12_MAX_FAT_COPIES);
+
+    // Compares what is on the image: pending FAT changes must be flushed first to be seen
+    static uint8_t packed[FAT12_MAX_FAT_COPIES][SECTOR_SIZE * FAT12_NUM_OF_FAT_TABLES_SECTORS];
+    disk_run_t runs[FAT12_MAX_FAT_COPIES];
+    for (uint32_t copy = 0; copy < copies; copy++) {
+        runs[copy] = (disk_run_t){
+            .buffer = packed[copy],
+            .first_sector = FAT12_FAT_TABLES_START + copy * FAT12_NUM_OF_FAT_TABLES_SECTORS,
+            .count = FAT12_NUM_OF_FAT_TABLES_SECTORS,
+        };
     }
+    if (!disk_read_runs(disk, runs, copies)) {
+        perror("Failed to read FAT copies");
+        return false;
+    }
+
+    static uint16_t reference[FAT12_FAT_TABLE_ENTRY_CAPACITY];
+    static uint16_t entries[FAT12_FAT_TABLE_ENTRY_CAPACITY];
+    bool has_reference = false;
 
-    return value;
+    for (uint32_t copy = 1; copy < copies; copy++) {
+        // Fast path, identical copies never get decoded
+        if (memcmp(packed[0], packed[copy], sizeof(packed[0])) == 0) continue;
+
+        if (!has_reference) {
+            f12c_unpack(packed[0], reference, FAT12_FAT_TABLE_ENTRY_CAPACITY / 2);
+            has_reference = true;
+        }
+        f12c_unpack(packed[copy], entries, FAT12_FAT_TABLE_ENTRY_CAPACITY / 2);
+
+        for (uint32_t entry = 0; entry < FAT12_FAT_TABLE_ENTRY_CAPACITY; entry++) {
+            if (entries[entry] == reference[entry]) continue;
+            fat12_fat_mismatch_s mismatch = {
+                .copy = copy, .entry = entry, .expected = reference[entry], .found = entries[entry]};
+            arrpush(*mismatches, mismatch);
+        }
+    }
+
+    return true;
 }
 
-bool fat12_set_table_entry(uint16_t entry_idx, uint16_t value) {
+// Reads a FAT12 table entry.
+uint16_t fat12_get_table_entry(uint16_t entry_idx) {
     assert(has_loaded_fat_table);
-    assert(entry_idx < 0xFFF);
-    assert(fat_table != NULL);
+    assert(entry_idx < FAT12_FAT_TABLE_ENTRY_CAPACITY);
 
-    // Compute byte offset = floor(entry_idx * 1.5)
-    uint32_t byte_offset = (entry_idx * 3) / 2;
+    return fat_entries[entry_idx];
+}
 
-    if ((entry_idx % 2) == 0) {
-        // If entry_idx is even, the first byte contains the low 8 bits
-        // and the second byte contains the high 4 bits.
-        fat_table[byte_offset] = value & 0xFF;                                                     // Low byte
-        fat_table[byte_offset + 1] = (fat_table[byte_offset + 1] & 0xF0) | ((value >> 8) & 0x0F);  // High nibble
-    } else {
-        // If entry_idx is odd, the first byte contains the low 4 bits
-        // and the second byte contains the high 8 bits.
-        fat_table[byte_offset] = (fat_table[byte_offset] & 0x0F) | ((value & 0x0F) << 4);  // High nibble
-        fat_table[byte_offset + 1] = value >> 4;                                           // High byte
+bool fat12_set_table_entry(uint16_t entry_idx, uint16_t value) {
+    assert(has_loaded_fat_table);
+    assert(entry_idx < FAT12_FAT_TABLE_ENTRY_CAPACITY);
+
+    value &= 0xFFF;
+    if (chain_owner[entry_idx] != 0) fat12_evict_chain(chain_owner[entry_idx]);
+    if (fat12_is_data_cluster(entry_idx) && (fat_entries[entry_idx] == FAT12_FREE) != (value == FAT12_FREE)) {
+        free_map[entry_idx / 64] ^= 1ULL << (entry_idx % 64);
+        free_extents_stale = true;
+        if (value == FAT12_FREE) {
+            free_clusters++;
+        } else {
+            free_clusters--;
+        }
     }
+    fat_entries[entry_idx] = value;
+
+    // The packed entry spans two bytes at floor(entry_idx * 1.5), which may sit in different sectors
+    // (entry 341 straddles sectors 0 and 1, entry 682 sectors 1 and 2)
+    uint32_t byte_offset = (entry_idx * 3) / 2;
+    fat_dirty_sectors |= 1u << (byte_offset / SECTOR_SIZE);
+    fat_dirty_sectors |= 1u << ((byte_offset + 1) / SECTOR_SIZE);
 
     return true;
 }
 
 uint16_t fat12_find_next_free_entry(uint16_t start_idx) {
     assert(has_loaded_fat_table);
-    assert(fat_table != NULL);
-    assert(start_idx < FAT12_NUM_OF_FAT_TABLES_ENTRIES);
 
-    for (uint16_t i = start_idx; i < FAT12_NUM_OF_FAT_TABLES_ENTRIES; i++) {
-        if (fat12_get_table_entry(i) == FAT12_FREE) {
-            return i;
+    if (start_idx < FAT12_DATA_AREA_NUMBER_OFFSET) start_idx = FAT12_DATA_AREA_NUMBER_OFFSET;
+
+    // A word at a time, the first word ignores the bits below start_idx
+    uint32_t word = start_idx / 64;
+    uint64_t bits = word < FAT12_FREE_MAP_WORDS ? free_map[word] & (~0ULL << (start_idx % 64)) : 0;
+    while (bits == 0 && ++word < FAT12_FREE_MAP_WORDS) {
+        bits = free_map[word];
+    }
+
+    if (bits == 0) {
+        fprintf(stderr, "No free entries found in the FAT table.\n");
+        return 0;  // < 2 indicates no free entries found
+    }
+    return word * 64 + __builtin_ctzll(bits);
+}
+
+uint32_t fat12_count_free_clusters(void) {
+    assert(has_loaded_fat_table);
+    return free_clusters;
+}
+
+const fat12_extent_s *fat12_free_extents(size_t *count) {
+    assert(has_loaded_fat_table);
+    assert(count != NULL);
+
+    if (free_extents_stale) fat12_build_free_extents();
+    *count = arrlen(free_extents);
+    return free_extents;
+}
+
+static int fat12_compare_extent_start(const void *a, const void *b) {
+    return (int)((const fat12_extent_s *)a)->start - (int)((const fat12_extent_s *)b)->start;
+}
+
+static uint32_t fat12_distance_to_extent(const fat12_extent_s *extent, uint16_t hint) {
+    if (extent->start >= hint) return extent->start - hint;
+    if (extent->start + extent->length <= hint) return hint - (extent->start + extent->length);
+    return 0;  // The hint is inside the free run
+}
+
+// Chooses the next free extent for `remaining` clusters under the current policy.
+// Sets from_tail when the clusters should come from the end of the extent (parent-locality, extent below the hint).
+static size_t fat12_pick_extent(const fat12_extent_s *extents, size_t count, const bool *taken, uint32_t remaining,
+                                uint16_t hint, bool *from_tail) {
+    *from_tail = false;
+
+    switch (alloc_policy) {
+        case FAT12_ALLOC_FIRST_FIT: {
+            // Lowest free run whatever its size, so the file fills the holes in address order
+            for (size_t i = 0; i < count; i++) {
+                if (!taken[i]) return i;
+            }
+            return count;
+        }
+
+        case FAT12_ALLOC_NEXT_FIT: {
+            // In address order from the rotating cursor
+            size_t first = 0;
+            while (first < count && extents[first].start + extents[first].length <= next_fit_cursor) first++;
+            if (first == count) first = 0;
+            size_t fallback = count;
+            for (size_t n = 0; n < count; n++) {
+                size_t i = (first + n) % count;
+                if (taken[i]) continue;
+                if (extents[i].length >= remaining) return i;
+                if (fallback == count) fallback = i;
+            }
+            return fallback;
+        }
+
+        case FAT12_ALLOC_PARENT_LOCALITY: {
+            // Nearest extent that holds what is left, otherwise the nearest one
+            size_t nearest_fit = count, nearest = count;
+            for (size_t i = 0; i < count; i++) {
+                if (taken[i]) continue;
+                uint32_t distance = fat12_distance_to_extent(&extents[i], hint);
+                if (extents[i].length >= remaining &&
+                    (nearest_fit == count || distance < fat12_distance_to_extent(&extents[nearest_fit], hint))) {
+                    nearest_fit = i;
+                }
+                if (nearest == count || distance < fat12_distance_to_extent(&extents[nearest], hint)) nearest = i;
+            }
+            size_t pick = nearest_fit < count ? nearest_fit : nearest;
+            if (pick < count) *from_tail = extents[pick].start + extents[pick].length <= hint;
+            return pick;
+        }
+
+        case FAT12_ALLOC_BEST_FIT:
+        default: {
+            // Smallest extent that holds what is left, lowest start on ties.
+            // Without one, the largest extent, so the file ends up in as few runs as possible.
+            size_t best = count, largest = count;
+            for (size_t i = 0; i < count; i++) {
+                if (taken[i]) continue;
+                if (extents[i].length >= remaining && (best == count || extents[i].length < extents[best].length)) best = i;
+                if (largest == count || extents[i].length > extents[largest].length) largest = i;
+            }
+            return best < count ? best : largest;
         }
     }
+}
+
+bool fat12_allocate_extents(uint32_t clusters, uint16_t hint, fat12_extent_s **runs) {
+    assert(has_loaded_fat_table);
+    assert(runs != NULL);
+
+    if (clusters == 0 || clusters > free_clusters) return false;
+
+    size_t count = 0;
+    const fat12_extent_s *extents = fat12_free_extents(&count);
+
+    // Taken extents are flagged here so the multi-run pass does not pick one twice
+    bool *taken = calloc(count, sizeof(bool));
+    if (taken == NULL) {
+        perror("Failed to allocate extent flags");
+        return false;
+    }
+
+    size_t first_run = arrlen(*runs);
+    uint32_t remaining = clusters;
+    while (remaining > 0) {
+        bool from_tail = false;
+        size_t pick = fat12_pick_extent(extents, count, taken, remaining, hint, &from_tail);
+        assert(pick < count);  // free_clusters >= clusters guarantees enough free extents
+        taken[pick] = true;
+
+        uint16_t length = extents[pick].length < remaining ? extents[pick].length : remaining;
+        uint16_t start = from_tail ? extents[pick].start + extents[pick].length - length : extents[pick].start;
+        fat12_extent_s run = {.start = start, .length = length};
+        arrpush(*runs, run);
+        remaining -= length;
+        next_fit_cursor = start + length;
+    }
+    free(taken);
 
-    fprintf(stderr, "No free entries found in the FAT table.\n");
-    return 0;  // < 2 indicates no free entries found
+    // Lay the runs out in disk order so the chain only moves forward
+    qsort(*runs + first_run, arrlen(*runs) - first_run, sizeof(fat12_extent_s), fat12_compare_extent_start);
+    return true;
 }
 
-bool fat12_get_table_entry_chain(uint16_t first_entry, uint16_t **chain) {
-    assert(first_entry < FAT12_NUM_OF_FAT_TABLES_ENTRIES);
+void fat12_set_allocation_policy(fat12_alloc_policy_e policy) { alloc_policy = policy; }
 
-    arrpush(*chain, first_entry);
-    size_t number_of_reads = 0;
+fat12_alloc_policy_e fat12_get_allocation_policy(void) { return alloc_policy; }
+
+const char *fat12_allocation_policy_name(fat12_alloc_policy_e policy) {
+    switch (policy) {
+        case FAT12_ALLOC_FIRST_FIT:
+            return "first-fit";
+        case FAT12_ALLOC_NEXT_FIT:
+            return "next-fit";
+        case FAT12_ALLOC_BEST_FIT:
+            return "best-fit";
+        case FAT12_ALLOC_PARENT_LOCALITY:
+            return "parent-locality";
+        default:
+            return "?";
+    }
+}
+
+uint32_t fat12_count_data_clusters(void) { return (FAT12_MAX_CLUSTER_NUMBER) - FAT12_DATA_AREA_NUMBER_OFFSET; }
 
-    uint16_t current_entry = *chain[arrlen(*chain) - 1];
+// Walks the chain in the FAT and caches it as runs. Returns NULL if the chain is broken.
+static fat12_cached_chain_s *fat12_load_chain(uint16_t first_entry) {
+    ptrdiff_t slot = hmgeti(chain_cache, first_entry);
+    if (slot >= 0) {
+        chain_cache_stats.hits++;
+        return &chain_cache[slot].value;
+    }
+    chain_cache_stats.misses++;
+
+    fat12_cached_chain_s chain = {0};
+    size_t number_of_reads = 0;
+    uint16_t current_entry = first_entry;
+    bool shared = false;  // A member already belongs to another cached chain (cross-linked FAT)
 
     while (true) {
+        size_t last = arrlen(chain.extents);
+        if (last > 0 && chain.extents[last - 1].start + chain.extents[last - 1].length == current_entry) {
+            chain.extents[last - 1].length++;
+        } else {
+            fat12_extent_s run = {.start = current_entry, .length = 1};
+            arrpush(chain.extents, run);
+            arrpush(chain.run_offsets, chain.length);
+        }
+        chain.length++;
+        shared |= chain_owner[current_entry] != 0;
+
         uint16_t next_entry = fat12_get_table_entry(current_entry);
         number_of_reads++;
 
-        if (number_of_reads > FAT12_NUM_OF_FAT_TABLES_ENTRIES) {
+        if (number_of_reads > FAT12_FAT_TABLE_ENTRY_CAPACITY) {
             fprintf(stderr, "Too many reads from FAT table, possible infinite loop detected.\n");
-            return false;  // Prevent infinite loop
+            fat12_free_cached_chain(&chain);
+            return NULL;  // Prevent infinite loop
         }
 
         if (next_entry >= FAT12_RESERVED_BEGIN && next_entry <= FAT12_RESERVED_END) {
             fprintf(stderr, "Invalid cluster encountered: %x\n", next_entry);
-            return false;  // Stop on invalid cluster
+            fat12_free_cached_chain(&chain);
+            return NULL;  // Stop on invalid cluster
         }
 
         if (next_entry == FAT12_BAD) {
             fprintf(stderr, "Bad cluster encountered: %x\n", next_entry);
-            return false;  // Stop on bad cluster
+            fat12_free_cached_chain(&chain);
+            return NULL;  // Stop on bad cluster
         }
         if (next_entry == FAT12_FREE) {
             fprintf(stderr, "Pointed to free cluster: %x\n", next_entry);
-            return false;  // Stop on bad cluster
+            fat12_free_cached_chain(&chain);
+            return NULL;  // Stop on bad cluster
         }
 
         if (next_entry >= FAT12_EOC_BEGIN && next_entry <= FAT12_EOC_END) {
             break;  // End of cluster
         }
 
+        if (next_entry >= FAT12_FAT_TABLE_ENTRY_CAPACITY) {
+            fprintf(stderr, "Cluster out of range: %x\n", next_entry);
+            fat12_free_cached_chain(&chain);
+            return NULL;  // Past the end of the table
+        }
+
         current_entry = next_entry;
-        arrpush(*chain, next_entry);
+    }
+
+    // Cross-linked chains are served uncached, an owner slot can only point at one of them
+    if (shared) {
+        static fat12_cached_chain_s uncached = {0};
+        fat12_free_cached_chain(&uncached);
+        uncached = chain;
+        return &uncached;
+    }
+
+    for (int i = 0; i < arrlen(chain.extents); i++) {
+        for (uint16_t c = 0; c < chain.extents[i].length; c++) {
+            chain_owner[chain.extents[i].start + c] = first_entry;
+        }
+    }
+    hmput(chain_cache, first_entry, chain);
+    return &hmgetp(chain_cache, first_entry)->value;
+}
+
+bool fat12_get_table_entry_chain(uint16_t first_entry, uint16_t **chain) {
+    assert(first_entry < FAT12_FAT_TABLE_ENTRY_CAPACITY);
+
+    // The chain array may already hold other chains
+    fat12_cached_chain_s *cached = fat12_load_chain(first_entry);
+    if (cached == NULL) return false;
+
+    for (int i = 0; i < arrlen(cached->extents); i++) {
+        for (uint16_t c = 0; c < cached->extents[i].length; c++) {
+            arrpush(*chain, cached->extents[i].start + c);
+        }
     }
 
     return true;
 }
 
+bool fat12_get_chain_extents(uint16_t first_entry, const fat12_extent_s **extents, size_t *count) {
+    assert(first_entry < FAT12_FAT_TABLE_ENTRY_CAPACITY);
+    assert(extents != NULL && count != NULL);
+
+    fat12_cached_chain_s *cached = fat12_load_chain(first_entry);
+    if (cached == NULL) return false;
+
+    *extents = cached->extents;
+    *count = arrlen(cached->extents);
+    return true;
+}
+
+uint32_t fat12_get_chain_length(uint16_t first_entry) {
+    assert(first_entry < FAT12_FAT_TABLE_ENTRY_CAPACITY);
+
+    fat12_cached_chain_s *cached = fat12_load_chain(first_entry);
+    return cached != NULL ? cached->length : 0;
+}
+
+uint16_t fat12_get_nth_cluster(uint16_t first_entry, uint32_t n) {
+    assert(first_entry < FAT12_FAT_TABLE_ENTRY_CAPACITY);
+
+    fat12_cached_chain_s *cached = fat12_load_chain(first_entry);
+    if (cached == NULL || n >= cached->length) return 0;
+
+    // Last run starting at or before n
+    size_t low = 0, high = arrlen(cached->extents);
+    while (high - low > 1) {
+        size_t mid = (low + high) / 2;
+        if (cached->run_offsets[mid] <= n) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return cached->extents[low].start + (n - cached->run_offsets[low]);
+}
+
+fat12_chain_cache_stats_s fat12_get_chain_cache_stats(void) {
+    fat12_chain_cache_stats_s stats = chain_cache_stats;
+    stats.chains = hmlen(chain_cache);
+    return stats;
+}
+
 fat12_file_subdir_s fat12_format_file_entry(
     const char *filename,
     const char *extension,
@@ -0,0 +1,195 @@
+#include "fat12_codec.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define F12C_HAVE_X86
+#include <immintrin.h>
+#endif
+
+// ───────────── Scalar ─────────────
+
+static void _f12c_unpack_scalar(const uint8_t *packed, uint16_t *entries, size_t pairs) {
+    for (size_t pair = 0; pair < pairs; pair++) {
+        const uint8_t *bytes = packed + pair * 3;
+        entries[pair * 2] = bytes[0] | ((bytes[1] & 0x0F) << 8);
+        entries[pair * 2 + 1] = (bytes[1] >> 4) | (bytes[2] << 4);
+    }
+}
+
+static void _f12c_pack_scalar(const uint16_t *entries, uint8_t *packed, size_t pairs) {
+    for (size_t pair = 0; pair < pairs; pair++) {
+        uint16_t even = entries[pair * 2] & 0xFFF;
+        uint16_t odd = entries[pair * 2 + 1] & 0xFFF;
+        uint8_t *bytes = packed + pair * 3;
+        bytes[0] = even & 0xFF;
+        bytes[1] = (even >> 8) | ((odd & 0x0F) << 4);
+        bytes[2] = odd >> 4;
+    }
+}
+
+#ifdef F12C_HAVE_X86
+// ───────────── SSSE3 / AVX2 ─────────────
+// Unpack: pshufb copies bytes (3k, 3k + 1) into the even lane of pair k and (3k + 1, 3k + 2) into the odd lane,
+// then even lanes keep their low 12 bits and odd lanes drop their low 4 bits.
+// Pack: each 32-bit lane holds one pair (even low, odd high) and becomes a 24-bit value; pshufb drops every 4th byte.
+// Both SSE steps read or write 16 bytes for 12 bytes of payload, so the loops stop while 4 bytes of slack remain.
+
+#define F12C_UNPACK_SHUFFLE 0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11
+#define F12C_PACK_SHUFFLE 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+
+__attribute__((target("ssse3"))) static inline __m128i _f12c_unpack_step(__m128i bytes) {
+    const __m128i shuffle = _mm_setr_epi8(F12C_UNPACK_SHUFFLE);
+    const __m128i even_mask = _mm_set1_epi32(0x00000FFF);
+    const __m128i odd_mask = _mm_set1_epi32(0x0FFF0000);
+
+    __m128i lanes = _mm_shuffle_epi8(bytes, shuffle);
+    __m128i even = _mm_and_si128(lanes, even_mask);
+    __m128i odd = _mm_and_si128(_mm_srli_epi16(lanes, 4), odd_mask);
+    return _mm_or_si128(even, odd);
+}
+
+__attribute__((target("ssse3"))) static inline __m128i _f12c_pack_step(__m128i entries) {
+    const __m128i shuffle = _mm_setr_epi8(F12C_PACK_SHUFFLE);
+    const __m128i even_mask = _mm_set1_epi32(0x00000FFF);
+    const __m128i odd_mask = _mm_set1_epi32(0x00FFF000);
+
+    __m128i even = _mm_and_si128(entries, even_mask);
+    __m128i odd = _mm_and_si128(_mm_srli_epi32(entries, 4), odd_mask);
+    return _mm_shuffle_epi8(_mm_or_si128(even, odd), shuffle);
+}
+
+__attribute__((target("ssse3"))) static void _f12c_unpack_ssse3(const uint8_t *packed, uint16_t *entries, size_t pairs) {
+    size_t pair = 0;
+    for (; pair + 6 <= pairs; pair += 4) {  // 12 bytes used, 16 read
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(packed + pair * 3));
+        _mm_storeu_si128((__m128i *)(entries + pair * 2), _f12c_unpack_step(bytes));
+    }
+    _f12c_unpack_scalar(packed + pair * 3, entries + pair * 2, pairs - pair);
+}
+
+__attribute__((target("ssse3"))) static void _f12c_pack_ssse3(const uint16_t *entries, uint8_t *packed, size_t pairs) {
+    size_t pair = 0;
+    for (; pair + 6 <= pairs; pair += 4) {  // 12 bytes used, 16 written, the next step overwrites the rest
+        __m128i lanes = _mm_loadu_si128((const __m128i *)(entries + pair * 2));
+        _mm_storeu_si128((__m128i *)(packed + pair * 3), _f12c_pack_step(lanes));
+    }
+    _f12c_pack_scalar(entries + pair * 2, packed + pair * 3, pairs - pair);
+}
+
+__attribute__((target("avx2"))) static void _f12c_unpack_avx2(const uint8_t *packed, uint16_t *entries, size_t pairs) {
+    const __m256i shuffle = _mm256_setr_epi8(F12C_UNPACK_SHUFFLE, F12C_UNPACK_SHUFFLE);
+    const __m256i even_mask = _mm256_set1_epi32(0x00000FFF);
+    const __m256i odd_mask = _mm256_set1_epi32(0x0FFF0000);
+
+    size_t pair = 0;
+    for (; pair + 10 <= pairs; pair += 8) {  // Two 12 byte groups, one per 128-bit lane, 28 bytes read
+        const uint8_t *source = packed + pair * 3;
+        __m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)source)),
+                                                _mm_loadu_si128((const __m128i *)(source + 12)), 1);
+        __m256i lanes = _mm256_shuffle_epi8(bytes, shuffle);
+        __m256i even = _mm256_and_si256(lanes, even_mask);
+        __m256i odd = _mm256_and_si256(_mm256_srli_epi16(lanes, 4), odd_mask);
+        _mm256_storeu_si256((__m256i *)(entries + pair * 2), _mm256_or_si256(even, odd));
+    }
+    _f12c_unpack_ssse3(packed + pair * 3, entries + pair * 2, pairs - pair);
+}
+
+__attribute__((target("avx2"))) static void _f12c_pack_avx2(const uint16_t *entries, uint8_t *packed, size_t pairs) {
+    const __m256i shuffle = _mm256_setr_epi8(F12C_PACK_SHUFFLE, F12C_PACK_SHUFFLE);
+    const __m256i even_mask = _mm256_set1_epi32(0x00000FFF);
+    const __m256i odd_mask = _mm256_set1_epi32(0x00FFF000);
+
+    size_t pair = 0;
+    for (; pair + 10 <= pairs; pair += 8) {  // 24 bytes used, 28 written
+        __m256i lanes = _mm256_loadu_si256((const __m256i *)(entries + pair * 2));
+        __m256i even = _mm256_and_si256(lanes, even_mask);
+        __m256i odd = _mm256_and_si256(_mm256_srli_epi32(lanes, 4), odd_mask);
+        __m256i bytes = _mm256_shuffle_epi8(_mm256_or_si256(even, odd), shuffle);
+
+        uint8_t *target = packed + pair * 3;
+        _mm_storeu_si128((__m128i *)target, _mm256_castsi256_si128(bytes));
+        _mm_storeu_si128((__m128i *)(target + 12), _mm256_extracti128_si256(bytes, 1));
+    }
+    _f12c_pack_ssse3(entries + pair * 2, packed + pair * 3, pairs - pair);
+}
+#endif
+
+// ───────────── Dispatch ─────────────
+
+static f12c_impl_e implementation = F12C_IMPL_SCALAR;
+static bool has_selected = false;
+
+static bool _f12c_supported(f12c_impl_e impl) {
+    switch (impl) {
+        case F12C_IMPL_SCALAR:
+            return true;
+#ifdef F12C_HAVE_X86
+        case F12C_IMPL_SSSE3:
+            return __builtin_cpu_supports("ssse3");
+        case F12C_IMPL_AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+static void _f12c_select_best(void) {
+    if (has_selected) return;
+    implementation = _f12c_supported(F12C_IMPL_AVX2)    ? F12C_IMPL_AVX2
+                     : _f12c_supported(F12C_IMPL_SSSE3) ? F12C_IMPL_SSSE3
+                                                        : F12C_IMPL_SCALAR;
+    has_selected = true;
+}
+
+bool f12c_select(f12c_impl_e impl) {
+    if (!_f12c_supported(impl)) return false;
+    implementation = impl;
+    has_selected = true;
+    return true;
+}
+
+const char *f12c_implementation_name(void) {
+    _f12c_select_best();
+    switch (implementation) {
+        case F12C_IMPL_AVX2:
+            return "avx2";
+        case F12C_IMPL_SSSE3:
+            return "ssse3";
+        default:
+            return "scalar";
+    }
+}
+
+void f12c_unpack(const uint8_t *packed, uint16_t *entries, size_t pairs) {
+    _f12c_select_best();
+    switch (implementation) {
+#ifdef F12C_HAVE_X86
+        case F12C_IMPL_AVX2:
+            _f12c_unpack_avx2(packed, entries, pairs);
+            return;
+        case F12C_IMPL_SSSE3:
+            _f12c_unpack_ssse3(packed, entries, pairs);
+            return;
+#endif
+        default:
+            _f12c_unpack_scalar(packed, entries, pairs);
+            return;
+    }
+}
+
+void f12c_pack(const uint16_t *entries, uint8_t *packed, size_t pairs) {
+    _f12c_select_best();
+    switch (implementation) {
+#ifdef F12C_HAVE_X86
+        case F12C_IMPL_AVX2:
+            _f12c_pack_avx2(entries, packed, pairs);
+            return;
+        case F12C_IMPL_SSSE3:
+            _f12c_pack_ssse3(entries, packed, pairs);
+            return;
+#endif
+        default:
+            _f12c_pack_scalar(entries, packed, pairs);
+            return;
+    }
+}
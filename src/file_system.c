@@ -1,7 +1,140 @@
 #include "file_system.h"
 
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "cluster_owner.h"
 #include "stb_ds.h"
 
+// Memory shared by every node of a tree
+struct fs_directory_tree {
+    arena_t arena;  // Nodes, children arrays and name indexes
+    uint64_t nodes;  // Linked nodes, see fs_tree_stats_t
+};
+
+// The mounted volume's directory tree, loaded lazily and kept in step with every add and remove
+static fs_directory_tree_node_t *dentry_cache = NULL;
+static uint64_t tree_generation = 0;  // Bumped by every node linked or unlinked and by resets
+
+static fs_directory_tree_node_t *_fs_new_tree_node(fs_directory_tree_t *tree, fs_directory_tree_node_t *parent,
+                                                   fs_directory_type_e type, const fat12_file_subdir_s *metadata);
+static void _fs_link_child(fs_directory_tree_node_t *dir, fs_directory_tree_node_t *child);
+
+static bool _fs_name_equals(const fat12_file_subdir_s *entry, const fs_fat_compatible_filename_t *name) {
+    return memcmp(entry->filename, name->file, FAT12_FILE_NAME_LENGTH) == 0 &&
+           memcmp(entry->extension, name->extension, FAT12_FILE_EXTENSION_LENGTH) == 0;
+}
+
+static fs_fat_compatible_filename_t _fs_entry_name(const fat12_file_subdir_s *entry) {
+    fs_fat_compatible_filename_t name;
+    memcpy(name.file, entry->filename, FAT12_FILE_NAME_LENGTH);
+    memcpy(name.extension, entry->extension, FAT12_FILE_EXTENSION_LENGTH);
+    return name;
+}
+
+// FNV-1a over the 11 packed bytes, name then extension
+static size_t _fs_name_hash(const char *file, const char *extension) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < FAT12_FILE_NAME_LENGTH; i++) {
+        hash = (hash ^ (uint8_t)file[i]) * 16777619u;
+    }
+    for (size_t i = 0; i < FAT12_FILE_EXTENSION_LENGTH; i++) {
+        hash = (hash ^ (uint8_t)extension[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Name index of a directory node: open addressing with linear probing over child_slots, kept at most half full.
+// Duplicate names on disk keep resolving to the first one, as the linear scan did.
+static fs_directory_tree_node_t *_fs_index_find(const fs_directory_tree_node_t *dir,
+                                                const fs_fat_compatible_filename_t *name) {
+    if (dir->child_slots_capacity == 0) return NULL;
+
+    size_t mask = dir->child_slots_capacity - 1;
+    for (size_t i = _fs_name_hash(name->file, name->extension) & mask;; i = (i + 1) & mask) {
+        fs_directory_tree_node_t *node = dir->child_slots[i];
+        if (node == NULL) return NULL;
+        if (_fs_name_equals(&node->metadata, name)) return node;
+    }
+}
+
+static void _fs_index_place(fs_directory_tree_node_t *dir, fs_directory_tree_node_t *child) {
+    const fat12_file_subdir_s *entry = &child->metadata;
+    size_t mask = dir->child_slots_capacity - 1;
+    for (size_t i = _fs_name_hash(entry->filename, entry->extension) & mask;; i = (i + 1) & mask) {
+        if (dir->child_slots[i] == NULL) {
+            dir->child_slots[i] = child;
+            return;
+        }
+        const fat12_file_subdir_s *other = &dir->child_slots[i]->metadata;
+        if (memcmp(other->filename, entry->filename, FAT12_FILE_NAME_LENGTH) == 0 &&
+            memcmp(other->extension, entry->extension, FAT12_FILE_EXTENSION_LENGTH) == 0) {
+            return;  // First one wins
+        }
+    }
+}
+
+// Called after child was appended to children
+static void _fs_index_insert(fs_directory_tree_node_t *dir, fs_directory_tree_node_t *child) {
+    if (dir->children_count * 2 > dir->child_slots_capacity) {
+        // Rebuilt from the children in order, so duplicates still resolve to the first one
+        size_t capacity = dir->child_slots_capacity ? dir->child_slots_capacity * 2 : FS_TREE_MIN_CHILDREN * 2;
+        dir->child_slots = arena_calloc(&dir->tree->arena, capacity * sizeof(*dir->child_slots));
+        dir->child_slots_capacity = capacity;
+        for (size_t i = 0; i < dir->children_count; i++) {
+            _fs_index_place(dir, dir->children[i]);
+        }
+        return;
+    }
+    _fs_index_place(dir, child);
+}
+
+static void _fs_index_remove(fs_directory_tree_node_t *dir, const fs_directory_tree_node_t *child) {
+    if (dir->child_slots_capacity == 0) return;
+
+    size_t mask = dir->child_slots_capacity - 1;
+    size_t hole = _fs_name_hash(child->metadata.filename, child->metadata.extension) & mask;
+    while (dir->child_slots[hole] != child) {
+        if (dir->child_slots[hole] == NULL) return;  // A duplicate that was never indexed
+        hole = (hole + 1) & mask;
+    }
+
+    // Backward shift: pull later entries of the probe run into the hole so lookups never stop early
+    dir->child_slots[hole] = NULL;
+    for (size_t i = (hole + 1) & mask; dir->child_slots[i] != NULL; i = (i + 1) & mask) {
+        const fat12_file_subdir_s *other = &dir->child_slots[i]->metadata;
+        size_t home = _fs_name_hash(other->filename, other->extension) & mask;
+        // Movable unless its home slot lies cyclically in (hole, i]
+        bool stays = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (!stays) {
+            dir->child_slots[hole] = dir->child_slots[i];
+            dir->child_slots[i] = NULL;
+            hole = i;
+        }
+    }
+}
+
+bool fs_pack_name(const char *name, fs_fat_compatible_filename_t *key) {
+    memset(key, ' ', sizeof(*key));
+
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        memcpy(key->file, name, strlen(name));
+        return true;
+    }
+
+    const char *dot = strrchr(name, '.');
+    size_t name_length = dot ? (size_t)(dot - name) : strlen(name);
+    size_t ext_length = dot ? strlen(dot + 1) : 0;
+    if (name_length == 0 || name_length > FAT12_FILE_NAME_LENGTH || ext_length > FAT12_FILE_EXTENSION_LENGTH ||
+        (dot && ext_length == 0)) {
+        return false;
+    }
+
+    memcpy(key->file, name, name_length);
+    if (dot) memcpy(key->extension, dot + 1, ext_length);
+    return true;
+}
+
 void fs_print_file_leaf(fat12_file_subdir_s dir, uint8_t depth) {
     for (uint8_t i = 0; i < depth; i++) {
         printf("  ");
@@ -49,210 +182,273 @@ void fs_print_ls_directory_header() {
     printf("Nome\t\tAtributo\tTamanho (bytes)\tData de Modificacao\tData de Criacao\t\tPrimeiro Cluster\n");
 }
 
-fs_directory_t fs_read_root_directory(FILE *disk) {
-    fat12_file_subdir_s *dir_entries = NULL;
+bool fs_add_file_to_directory(disk_t *disk, fs_directory_tree_node_t *dir_node, fat12_file_subdir_s file_entry) {
+    assert(disk != NULL);
+    assert(dir_node != NULL);
+    assert(file_entry.filename[0] != 0x00);
 
-    for (uint8_t i = 0; i < FAT12_ROOT_DIRECTORY_ENTRIES; i++) {
-        fat12_file_subdir_s dir_entry = fat12_read_directory_entry(disk, i);
+    // The name index answers the duplicate check, so the directory has to be loaded
+    if (!fs_load_children(disk, dir_node)) return false;
+    fs_fat_compatible_filename_t name = _fs_entry_name(&file_entry);
+    if (_fs_index_find(dir_node, &name) != NULL) {
+        fprintf(stderr, "Entry %.8s.%.3s already exists\n", file_entry.filename, file_entry.extension);
+        return false;
+    }
 
-        if (dir_entry.filename[0] != 0x00) {
-            arrpush(dir_entries, dir_entry);
-        }
+    fat12_dir_entry_s entry = fat12_allocate_entry_in_directory(disk, dir_node->metadata.first_cluster);
+    if (entry.cluster == 0 && entry.idx == 0) {
+        fprintf(stderr, "Failed to allocate directory entry for %s\n", file_entry.filename);
+        return false;  // Failed to allocate entry
     }
 
-    fat12_file_subdir_s *files = NULL;
-    fat12_file_subdir_s *subdirs = NULL;
+    if (!fat12_write_directory(
+            disk,
+            entry.cluster,
+            entry.idx,
+            file_entry)) {
+        fprintf(stderr, "Failed to write directory entry for %s\n", file_entry.filename);
+        return false;  // Failed to write entry
+    }
+    co_assign(entry, file_entry.first_cluster);
 
-    for (int i = 0; i < arrlen(dir_entries); i++) {
-        if (dir_entries[i].attributes & FAT12_ATTR_DIRECTORY) {
-            arrpush(subdirs, dir_entries[i]);
-        } else if (dir_entries[i].extension[0] != 0x00 || dir_entries[i].filename[0] != 0x00) {
-            arrpush(files, dir_entries[i]);
+    fs_directory_type_e type = (file_entry.attributes & FAT12_ATTR_DIRECTORY) ? FS_DIRECTORY_TYPE_SUBDIR
+                                                                               : FS_DIRECTORY_TYPE_FILE;
+    _fs_link_child(dir_node, _fs_new_tree_node(dir_node->tree, dir_node, type, &file_entry));
+
+    return true;
+}
+
+// Queues the cluster chains of every subdirectory in a listing as one batched read,
+// so the full walk below finds all of them in the sector cache.
+static void _fs_prefetch_subdirs(disk_t *disk, fs_directory_tree_node_t *dir) {
+    uint16_t *clusters = NULL;
+
+    for (size_t i = 0; i < dir->children_count; i++) {
+        fs_directory_tree_node_t *child = dir->children[i];
+        // Same skip rule as the loader: no data, or "." / ".."
+        if (child->children_loaded || child->metadata.first_cluster < FAT12_DATA_AREA_NUMBER_OFFSET) {
+            continue;
+        }
+        if (!fat12_get_table_entry_chain(child->metadata.first_cluster, &clusters)) {
+            continue;  // The loader reports broken chains
         }
     }
 
-    arrfree(dir_entries);
-    fs_directory_t dir = {.files = files, .subdirs = subdirs};
-    return dir;
+    fat12_prefetch_clusters(disk, clusters, arrlen(clusters));
+    arrfree(clusters);
 }
 
-fs_directory_t fs_read_directory(FILE *disk, uint16_t cluster) {
-    fat12_file_subdir_s *dir_entries = NULL;
+static fs_directory_tree_node_t *_fs_new_tree_node(fs_directory_tree_t *tree, fs_directory_tree_node_t *parent,
+                                                   fs_directory_type_e type, const fat12_file_subdir_s *metadata) {
+    fs_directory_tree_node_t *node = arena_alloc(&tree->arena, sizeof(*node));
+    node->parent = parent;
+    node->children = NULL;
+    node->children_count = 0;
+    node->children_capacity = 0;
+    node->child_slots = NULL;
+    node->child_slots_capacity = 0;
+    node->tree = tree;
+    node->type = type;
+    node->metadata = *metadata;
+    node->depth = parent ? parent->depth + 1 : 0;
+
+    // Files, "." and ".." never have children to read; ".." of a first level directory has cluster 0 too
+    node->children_loaded = type == FS_DIRECTORY_TYPE_FILE || metadata->filename[0] == '.' ||
+                            (parent != NULL && metadata->first_cluster < FAT12_DATA_AREA_NUMBER_OFFSET);
+    tree->nodes++;
+    return node;
+}
 
-    for (uint8_t i = 0; i < FAT12_DIRECTORY_ENTRIES_PER_SECTOR; i++) {
-        fat12_file_subdir_s dir_entry = fat12_read_directory_from_data_area(disk, cluster, i);
+static void _fs_link_child(fs_directory_tree_node_t *dir, fs_directory_tree_node_t *child) {
+    fs_directory_tree_t *tree = dir->tree;
 
-        if (dir_entry.filename[0] != 0x00) {
-            arrpush(dir_entries, dir_entry);
+    if (dir->children_count == dir->children_capacity) {
+        // The old array stays in the arena, doubling keeps that waste under the live size
+        size_t capacity = dir->children_capacity ? dir->children_capacity * 2 : FS_TREE_MIN_CHILDREN;
+        fs_directory_tree_node_t **children = arena_alloc(&tree->arena, capacity * sizeof(*children));
+        if (dir->children_count > 0) {
+            memcpy(children, dir->children, dir->children_count * sizeof(*children));
         }
+        dir->children = children;
+        dir->children_capacity = capacity;
     }
+    dir->children[dir->children_count++] = child;
+    _fs_index_insert(dir, child);
+    tree_generation++;
+}
 
-    fat12_file_subdir_s *files = NULL;
-    fat12_file_subdir_s *subdirs = NULL;
-
-    for (int i = 0; i < arrlen(dir_entries); i++) {
-        if (dir_entries[i].attributes == FAT12_ATTR_DIRECTORY) {
-            arrpush(subdirs, dir_entries[i]);
-        } else if (dir_entries[i].extension[0] != 0x00 || dir_entries[i].filename[0] != 0x00) {
-            arrpush(files, dir_entries[i]);
+// Adds the entries of one directory sector run straight from the view, subdirectories first like the listings.
+// The only place directory entries are classified: stops at the end marker and skips deleted entries.
+static void _fs_add_entries(fs_directory_tree_node_t *dir, const fat12_file_subdir_s *entries, size_t count) {
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < count; i++) {
+            uint8_t first = (uint8_t)entries[i].filename[0];
+            if (first == FAT12_ENTRY_END) break;
+            if (first == FAT12_ENTRY_DELETED) continue;
+
+            bool is_subdir = (entries[i].attributes & FAT12_ATTR_DIRECTORY) != 0;
+            if (is_subdir != (pass == 0)) continue;
+            fs_directory_type_e type = is_subdir ? FS_DIRECTORY_TYPE_SUBDIR : FS_DIRECTORY_TYPE_FILE;
+            _fs_link_child(dir, _fs_new_tree_node(dir->tree, dir, type, &entries[i]));
         }
     }
-
-    arrfree(dir_entries);
-    fs_directory_t dir = {.files = files, .subdirs = subdirs};
-    return dir;
 }
 
-bool fs_add_file_to_directory(FILE *disk, fs_directory_tree_node_t *dir_node, fat12_file_subdir_s file_entry) {
-    assert(disk != NULL);
-    assert(dir_node != NULL);
-    assert(file_entry.filename[0] != 0x00);
+fs_directory_tree_node_t *fs_find_child(fs_directory_tree_node_t *dir, const char *name) {
+    fs_fat_compatible_filename_t key;
+    if (!fs_pack_name(name, &key)) return NULL;
+    return _fs_index_find(dir, &key);
+}
 
-    fat12_dir_entry_s entry = fat12_allocate_entry_in_directory(disk, dir_node->metadata.first_cluster);
-    if (entry.cluster == 0 && entry.idx == 0) {
-        fprintf(stderr, "Failed to allocate directory entry for %s\n", file_entry.filename);
-        return false;  // Failed to allocate entry
-    }
+// Forgets whatever a failed load linked, so the next lookup reads the directory again from scratch.
+// The nodes stay in the arena until the tree is freed.
+static void _fs_drop_children(fs_directory_tree_node_t *dir) {
+    if (dir->children_count == 0) return;
 
-    if (!fat12_write_directory(
-            disk,
-            entry.cluster,
-            entry.idx,
-            file_entry)) {
-        fprintf(stderr, "Failed to write directory entry for %s\n", file_entry.filename);
-        return false;  // Failed to write entry
+    dir->tree->nodes -= dir->children_count;
+    dir->children_count = 0;
+    if (dir->child_slots_capacity > 0) {
+        memset(dir->child_slots, 0, dir->child_slots_capacity * sizeof(*dir->child_slots));
     }
-
-    return true;
+    tree_generation++;
 }
 
-static void _fs_recursive_create_subdirs_tree(FILE *disk, fs_directory_tree_node_t *dir) {
-    if (dir->depth >= FS_MAX_DIRECTORY_DEPTH) {
-        fprintf(stderr, "Maximum directory depth reached: %llu\n", dir->depth);
-        return;  // Prevent infinite recursion
+static bool _fs_read_children(disk_t *disk, fs_directory_tree_node_t *dir) {
+    if (dir->parent == NULL) {
+        fat12_file_subdir_s entries[FAT12_ROOT_DIRECTORY_ENTRIES];
+        if (!fat12_read_root_directory(disk, entries)) return false;
+        _fs_add_entries(dir, entries, FAT12_ROOT_DIRECTORY_ENTRIES);
+        return true;
     }
 
-    if (dir->metadata.first_cluster < FAT12_DATA_AREA_NUMBER_OFFSET ||
-        dir->metadata.first_cluster == dir->parent->metadata.first_cluster) {
-        return;  // Skip empty or cyclic entries
+    if (dir->depth >= FS_MAX_DIRECTORY_DEPTH) {
+        fprintf(stderr, "Maximum directory depth reached: %zu\n", dir->depth);
+        return false;
     }
 
     uint16_t *cluster_list = NULL;
-
     if (!fat12_get_table_entry_chain(dir->metadata.first_cluster, &cluster_list)) {
         fprintf(stderr, "Failed to get cluster chain for %s\n", dir->metadata.filename);
         arrfree(cluster_list);
-        return;
+        return false;
     }
 
+    // Usually already cached by the parent's prefetch during a full walk, this only reads what is missing
+    fat12_prefetch_clusters(disk, cluster_list, arrlen(cluster_list));
+
     for (int i = 0; i < arrlen(cluster_list); i++) {
-        fs_directory_t listing = fs_read_directory(disk, cluster_list[i]);
-
-        // subdirectories
-        for (int i = 0; i < arrlen(listing.subdirs); i++) {
-            fs_directory_tree_node_t *subdir_node = malloc(sizeof(*subdir_node));
-            if (!subdir_node) {
-                perror("malloc subdir node");
-                fs_free_directory(listing);
-                arrfree(cluster_list);
-                exit(EXIT_FAILURE);
-            }
-            subdir_node->parent = dir;
-            subdir_node->children = NULL;
-            subdir_node->type = FS_DIRECTORY_TYPE_SUBDIR;
-            subdir_node->metadata = listing.subdirs[i];
-            subdir_node->depth = dir->depth + 1;
+        _fs_add_entries(dir, fat12_view_directory_cluster(disk, cluster_list[i]), FAT12_DIRECTORY_ENTRIES_PER_SECTOR);
+    }
 
-            // recurse
-            _fs_recursive_create_subdirs_tree(disk, subdir_node);
+    arrfree(cluster_list);
+    return true;
+}
 
-            arrpush(dir->children, subdir_node);
-        }
+bool fs_load_children(disk_t *disk, fs_directory_tree_node_t *dir) {
+    assert(disk != NULL);
+    assert(dir != NULL);
 
-        // files
-        for (int i = 0; i < arrlen(listing.files); i++) {
-            fs_directory_tree_node_t *file_node = malloc(sizeof(*file_node));
-            if (!file_node) {
-                perror("malloc file node");
-                fs_free_directory(listing);
-                arrfree(cluster_list);
-                exit(EXIT_FAILURE);
-            }
-            file_node->parent = dir;
-            file_node->children = NULL;
-            file_node->type = FS_DIRECTORY_TYPE_FILE;
-            file_node->metadata = listing.files[i];
-            file_node->depth = dir->depth + 1;
+    if (dir->children_loaded) return true;
 
-            arrpush(dir->children, file_node);
+    // Only a complete listing is cached: a partial one would hide entries from lookups and the duplicate check
+    if (!_fs_read_children(disk, dir)) {
+        _fs_drop_children(dir);
+        return false;
+    }
+    dir->children_loaded = true;
+    return true;
+}
+
+bool fs_load_subtree(disk_t *disk, fs_directory_tree_node_t *dir) {
+    if (!fs_load_children(disk, dir)) return false;
+    _fs_prefetch_subdirs(disk, dir);
+
+    for (size_t i = 0; i < dir->children_count; i++) {
+        // Loaded subtrees may still have unloaded directories further down
+        if (dir->children[i]->type == FS_DIRECTORY_TYPE_SUBDIR && dir->children[i]->metadata.filename[0] != '.') {
+            if (!fs_load_subtree(disk, dir->children[i])) return false;
         }
+    }
+    return true;
+}
 
-        fs_free_directory(listing);
+fs_directory_tree_node_t *fs_open_disk_tree(void) {
+    fs_directory_tree_t *tree = malloc(sizeof(*tree));
+    if (!tree) {
+        perror("malloc directory tree");
+        exit(EXIT_FAILURE);
     }
+    arena_init(&tree->arena, FS_TREE_ARENA_BLOCK_SIZE);
+    tree->nodes = 0;
 
-    arrfree(cluster_list);
+    fat12_file_subdir_s metadata = {0};
+    metadata.filename[0] = '/';  // Root directory name
+    return _fs_new_tree_node(tree, NULL, FS_DIRECTORY_TYPE_SUBDIR, &metadata);
 }
 
-fs_directory_tree_node_t *fs_create_disk_tree(FILE *disk) {
-    // allocate the root node on the heap
-    fs_directory_tree_node_t *root = malloc(sizeof(*root));
-    if (!root) {
-        perror("malloc root node");
-        exit(EXIT_FAILURE);
+fs_directory_tree_node_t *fs_get_dentry_cache(void) {
+    if (dentry_cache == NULL) {
+        dentry_cache = fs_open_disk_tree();
     }
+    return dentry_cache;
+}
 
-    // init root
-    root->parent = NULL;
-    root->children = NULL;
-    root->type = FS_DIRECTORY_TYPE_SUBDIR;
-    memset(&root->metadata, 0, sizeof(root->metadata));
-    root->metadata.filename[0] = '/';  // Root directory name
-    root->depth = 0;
-
-    // read the very first (root) directory entries
-    fs_directory_t root_dir = fs_read_root_directory(disk);
-
-    // add subdirectories in root
-    for (int i = 0; i < arrlen(root_dir.subdirs); i++) {
-        fs_directory_tree_node_t *subdir_node = malloc(sizeof(*subdir_node));
-        if (!subdir_node) {
-            perror("malloc subdir node");
-            fs_free_directory(root_dir);
-            exit(EXIT_FAILURE);
-        }
-        subdir_node->parent = root;
-        subdir_node->children = NULL;
-        subdir_node->type = FS_DIRECTORY_TYPE_SUBDIR;
-        subdir_node->metadata = root_dir.subdirs[i];
-        subdir_node->depth = 1;
+void fs_reset_dentry_cache(void) {
+    fs_free_disk_tree(dentry_cache);
+    dentry_cache = NULL;
+    tree_generation++;
+}
 
-        // recurse into it
-        _fs_recursive_create_subdirs_tree(disk, subdir_node);
+uint64_t fs_get_tree_generation(void) { return tree_generation; }
+
+fs_tree_stats_t fs_get_tree_stats(const fs_directory_tree_node_t *node) {
+    const fs_directory_tree_t *tree = node->tree;
+    return (fs_tree_stats_t){
+        .nodes = tree->nodes,
+        .arena_allocations = tree->arena.allocations,
+        .arena_blocks = tree->arena.blocks,
+        .arena_bytes_used = tree->arena.bytes_used,
+        .arena_bytes_reserved = tree->arena.bytes_reserved,
+    };
+}
 
-        arrpush(root->children, subdir_node);
+// Nodes in the subtree rooted at node, node included. "." and ".." never have children, so this does not loop.
+static uint64_t _fs_count_subtree(const fs_directory_tree_node_t *node) {
+    uint64_t count = 1;
+    for (size_t i = 0; i < node->children_count; i++) {
+        count += _fs_count_subtree(node->children[i]);
     }
+    return count;
+}
 
-    // add files in root
-    for (int i = 0; i < arrlen(root_dir.files); i++) {
-        fs_directory_tree_node_t *file_node = malloc(sizeof(*file_node));
-        if (!file_node) {
-            perror("malloc file node");
-            fs_free_directory(root_dir);
-            exit(EXIT_FAILURE);
+// Unlinks a removed node from its parent, its memory stays in the arena until the tree is freed
+static void _fs_forget_node(fs_directory_tree_node_t *node) {
+    fs_directory_tree_node_t *parent = node->parent;
+    node->tree->nodes -= _fs_count_subtree(node);
+    for (size_t i = 0; i < parent->children_count; i++) {
+        if (parent->children[i] == node) {
+            memmove(&parent->children[i], &parent->children[i + 1],
+                    (parent->children_count - i - 1) * sizeof(*parent->children));
+            parent->children_count--;
+            tree_generation++;
+            break;
         }
-        file_node->parent = root;
-        file_node->children = NULL;
-        file_node->type = FS_DIRECTORY_TYPE_FILE;
-        file_node->metadata = root_dir.files[i];
-        file_node->depth = 1;
-        arrpush(root->children, file_node);
     }
 
-    fs_free_directory(root_dir);
-    return root;
+    // A duplicate of the same name, if any, takes over the index slot
+    fs_fat_compatible_filename_t name = _fs_entry_name(&node->metadata);
+    if (_fs_index_find(parent, &name) == node) {
+        _fs_index_remove(parent, node);
+        for (size_t i = 0; i < parent->children_count; i++) {
+            if (_fs_name_equals(&parent->children[i]->metadata, &name)) {
+                _fs_index_place(parent, parent->children[i]);
+                break;
+            }
+        }
+    }
 }
 
-fs_directory_tree_node_t *fs_get_node_by_path(fs_directory_tree_node_t *root, const char *path) {
+fs_directory_tree_node_t *fs_get_node_by_path(disk_t *disk, fs_directory_tree_node_t *root, const char *path) {
     if (!root || !path || path[0] != '/') {
         return NULL;  // Invalid input
     }
@@ -268,22 +464,15 @@ fs_directory_tree_node_t *fs_get_node_by_path(fs_directory_tree_node_t *root, co
     fs_directory_tree_node_t *current_node = root;
 
     while (token) {
-        bool found = false;
-
-        // Search for the next component in the current node's children
-        for (int i = 0; i < arrlen(current_node->children); i++) {
-            fs_directory_tree_node_t *child = current_node->children[i];
-            char name[FS_MAX_FILENAME_LENGTH];
-            f12h_format_filename(child->metadata, name);
-
-            if (strcmp(name, token) == 0) {
-                current_node = child;
-                found = true;
-                break;
-            }
+        // Only the directories along the path are read
+        if (!fs_load_children(disk, current_node)) {
+            free(path_copy);
+            return NULL;
         }
 
-        if (!found) {
+        // One probe of the name index per component
+        current_node = fs_find_child(current_node, token);
+        if (current_node == NULL) {
             free(path_copy);
             return NULL;  // Component not found
         }
@@ -295,7 +484,7 @@ fs_directory_tree_node_t *fs_get_node_by_path(fs_directory_tree_node_t *root, co
     return current_node;  // Return the found node
 }
 
-fs_directory_tree_node_t *fs_get_directory_node_by_path(fs_directory_tree_node_t *root, const char *path) {
+fs_directory_tree_node_t *fs_get_directory_node_by_path(disk_t *disk, fs_directory_tree_node_t *root, const char *path) {
     if (!root || !path || path[0] != '/') {
         return NULL;
     }
@@ -318,7 +507,7 @@ fs_directory_tree_node_t *fs_get_directory_node_by_path(fs_directory_tree_node_t
     }
 
     *last_slash = '\0';
-    fs_directory_tree_node_t *dir_node = fs_get_node_by_path(root, path_copy);
+    fs_directory_tree_node_t *dir_node = fs_get_node_by_path(disk, root, path_copy);
     free(path_copy);
 
     if (!dir_node || dir_node->type != FS_DIRECTORY_TYPE_SUBDIR) {
@@ -328,60 +517,14 @@ fs_directory_tree_node_t *fs_get_directory_node_by_path(fs_directory_tree_node_t
     return dir_node;
 }
 
-static void _fs_print_tree_ascii(
-    fs_directory_tree_node_t *node,
-    const char *prefix,
-    bool is_last) {
-    char name[FS_MAX_FILENAME_LENGTH];
-    f12h_format_filename(node->metadata, name);
-
-    // Use ASCII-friendly tree characters
-    printf("%s", prefix);
-    printf("%s", is_last ? "`-- " : "|-- ");
-    printf("%s%s\n", name,
-           node->type == FS_DIRECTORY_TYPE_SUBDIR ? "/" : "");
-
-    // Build new prefix
-    char new_prefix[256];
-    snprintf(new_prefix, sizeof(new_prefix), "%s%s",
-             prefix,
-             is_last ? "    " : "|   ");
-
-    size_t count = arrlen(node->children);
-    for (size_t i = 0; i < count; i++) {
-        bool last = (i + 1 == count);
-        _fs_print_tree_ascii(node->children[i], new_prefix, last);
-    }
-}
-
-void fs_print_directory_tree(fs_directory_tree_node_t *root) {
-    if (!root) return;
-
-    printf("/\n");
-
-    size_t count = arrlen(root->children);
-    for (size_t i = 0; i < count; i++) {
-        bool last = (i + 1 == count);
-        _fs_print_tree_ascii(root->children[i], "", last);
-    }
-}
-
-void fs_free_directory(fs_directory_t dir) {
-    arrfree(dir.files);
-    arrfree(dir.subdirs);
-}
-
 void fs_free_disk_tree(fs_directory_tree_node_t *dir_tree) {
     if (!dir_tree) return;
+    assert(dir_tree->parent == NULL);
 
-    // Recursively free all children
-    for (int i = 0, n = arrlen(dir_tree->children); i < n; i++) {
-        fs_free_disk_tree(dir_tree->children[i]);
-    }
-
-    // Free the dynamic array of children pointers then self
-    arrfree(dir_tree->children);
-    free(dir_tree);
+    // Every node, children array and index lives in the arena, no walk needed
+    fs_directory_tree_t *tree = dir_tree->tree;
+    arena_release(&tree->arena);
+    free(tree);
 }
 
 fs_fat_compatible_filename_t fs_get_filename_from_path(const char *path) {
@@ -446,39 +589,73 @@ fs_fat_compatible_filename_t fs_get_filename_from_path(const char *path) {
     return filename;
 }
 
-uint32_t fs_write_file_to_data_area(FILE *source_file, FILE *disk, uint16_t **cluster_list) {
-    uint8_t buffer[SECTOR_SIZE] = {0};
+uint32_t fs_write_file_to_data_area(FILE *source_file, disk_t *disk, uint16_t parent_cluster, uint16_t **cluster_list) {
+    // The size is known up front, so the clusters are reserved as whole runs instead of one free cluster at a time
+    struct stat source_stat;
+    if (fstat(fileno(source_file), &source_stat) != 0) {
+        perror("Erro ao obter o tamanho do arquivo de origem");
+        return 0;
+    }
+    if (source_stat.st_size <= 0) return 0;
 
-    size_t bytes_read = 0;
-    uint32_t total_bytes = 0;
-    uint16_t nex_entry_idx = 0;
-
-    while ((bytes_read = fread(buffer, 1, SECTOR_SIZE, source_file)) > 0) {
-        // Find the next free entry in the FAT table
-        uint16_t table_entry = fat12_find_next_free_entry(nex_entry_idx);
-        if (table_entry < FAT12_FAT_TABLES_RESERVED_ENTRIES) {
-            fprintf(stderr, "Nao ha entradas livres na tabela FAT.\n");
-            return 0;
-        }
+    uint32_t clusters = (source_stat.st_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    fat12_extent_s *runs = NULL;
+    // The root directory is not in the data area, its files are placed near the start of it
+    uint16_t hint = parent_cluster >= FAT12_DATA_AREA_NUMBER_OFFSET ? parent_cluster : FAT12_DATA_AREA_NUMBER_OFFSET;
+    if (!fat12_allocate_extents(clusters, hint, &runs)) {
+        fprintf(stderr, "Nao ha clusters livres suficientes na tabela FAT (%u necessarios, %u livres).\n",
+                clusters, fat12_count_free_clusters());
+        arrfree(runs);
+        return 0;
+    }
 
-        if (fat12_write_data_sector(disk, buffer, table_entry) == false) {
-            fprintf(stderr, "Erro ao escrever no setor de dados do cluster %d\n", table_entry);
-            return 0;
-        }
+    uint8_t *buffer = malloc(FS_WRITE_CHUNK_CLUSTERS * SECTOR_SIZE);
+    if (buffer == NULL) {
+        perror("Erro ao alocar o buffer de escrita");
+        arrfree(runs);
+        return 0;
+    }
+
+    uint32_t total_bytes = 0;
+    bool reached_end = false;
+    for (int i = 0; i < arrlen(runs) && !reached_end; i++) {
+        for (uint16_t done = 0; done < runs[i].length && !reached_end;) {
+            uint16_t count = runs[i].length - done;
+            if (count > FS_WRITE_CHUNK_CLUSTERS) count = FS_WRITE_CHUNK_CLUSTERS;
+
+            size_t bytes_read = fread(buffer, 1, (size_t)count * SECTOR_SIZE, source_file);
+            if (bytes_read == 0) break;
+            if (bytes_read < (size_t)count * SECTOR_SIZE) {
+                // The file shrank or this is the last cluster: pad it, later clusters of the run stay unused
+                reached_end = true;
+                count = (bytes_read + SECTOR_SIZE - 1) / SECTOR_SIZE;
+                memset(buffer + bytes_read, 0, (size_t)count * SECTOR_SIZE - bytes_read);
+            }
 
-        printf("%llu bytes escritos no cluster %u\n", bytes_read, table_entry);
+            uint16_t first = runs[i].start + done;
+            if (!fat12_write_data_clusters(disk, buffer, first, count)) {
+                fprintf(stderr, "Erro ao escrever nos clusters de dados %u-%u\n", first, first + count - 1);
+                free(buffer);
+                arrfree(runs);
+                return 0;
+            }
 
-        // Add the entry to the cluster list
-        arrpush(*cluster_list, table_entry);
+            printf("%zu bytes escritos nos clusters %u-%u\n", bytes_read, first, first + count - 1);
 
-        total_bytes += bytes_read;
-        nex_entry_idx = table_entry + 1;
+            for (uint16_t c = 0; c < count; c++) {
+                arrpush(*cluster_list, first + c);
+            }
+            total_bytes += bytes_read;
+            done += count;
+        }
     }
 
+    free(buffer);
+    arrfree(runs);
     return total_bytes;  // Return the total number of bytes written
 }
 
-bool fs_write_cluster_chain_to_fat_table(FILE *disk, uint16_t *cluster_list) {
+bool fs_write_cluster_chain_to_fat_table(disk_t *disk, uint16_t *cluster_list) {
     for (int i = 0; i < arrlen(cluster_list); i++) {
         uint16_t entry = cluster_list[i];
         uint16_t next_entry = (i < ((int)arrlen(cluster_list)) - 1) ? cluster_list[i + 1] : FAT12_EOC_END;
@@ -487,16 +664,47 @@ bool fs_write_cluster_chain_to_fat_table(FILE *disk, uint16_t *cluster_list) {
             return false;
         }
     }
-    fat12_write_full_fat_table(disk);
+    fat12_flush_fat_table(disk);
 
     return true;  // Return true if all entries were written successfully
 }
 
-bool fs_remove_file_or_directory(FILE *disk, fs_directory_tree_node_t *dir_node) {
+// Whether the directory entry at dirent still describes the given file (same name and first cluster)
+static bool _fs_entry_matches(disk_t *disk, fat12_dir_entry_s dirent, const fat12_file_subdir_s *file) {
+    const fat12_file_subdir_s *entry = dirent.cluster == 0
+                                           ? fat12_view_directory_entry(disk, dirent.idx)
+                                           : fat12_view_directory_from_data_area(disk, dirent.cluster, dirent.idx);
+    return entry->first_cluster == file->first_cluster &&
+           memcmp(entry->filename, file->filename, FAT12_FILE_NAME_LENGTH + FAT12_FILE_EXTENSION_LENGTH) == 0;
+}
+
+void fs_begin_transaction(void) { fat12_begin_transaction(); }
+
+bool fs_commit_transaction(disk_t *disk) {
+    if (fat12_commit_transaction(disk)) return true;
+
+    // Rolled back, or partly written: the owners and the cached tree must match the disk again
+    if (!fat12_in_transaction()) {
+        co_build(disk);
+        fs_reset_dentry_cache();
+    }
+    return false;
+}
+
+void fs_abort_transaction(disk_t *disk) {
+    fat12_abort_transaction();
+    co_build(disk);
+    fs_reset_dentry_cache();
+}
+
+static bool _fs_remove_node(disk_t *disk, fs_directory_tree_node_t *dir_node) {
     // If it has children, it is a directory and will be recursively deleted.
-    if (arrlen(dir_node->children) > 0) {
-        for (int i = 0; i < arrlen(dir_node->children); i++) {
-            fs_remove_file_or_directory(disk, dir_node->children[i]);
+    if (!fs_load_children(disk, dir_node)) return false;
+    if (dir_node->children_count > 0) {
+        for (size_t i = 0; i < dir_node->children_count; i++) {
+            // "." and ".." point at this directory and its parent, they go away with this directory's clusters
+            if (dir_node->children[i]->metadata.filename[0] == '.') continue;
+            if (!_fs_remove_node(disk, dir_node->children[i])) return false;
         }
     }
 
@@ -511,6 +719,12 @@ bool fs_remove_file_or_directory(FILE *disk, fs_directory_tree_node_t *dir_node)
         return false;
     }
 
+    // Locate the entry through the reverse map while the chain is still linked
+    co_owner_s owner;
+    bool has_location = co_lookup_cluster(dir_node->metadata.first_cluster, &owner) &&
+                        owner.first_cluster == dir_node->metadata.first_cluster && owner.file_index == 0;
+    co_release(dir_node->metadata.first_cluster);
+
     // Remove the entry from the FAT table
     for (int i = 0; i < arrlen(cluster_list); i++) {
         uint16_t entry = cluster_list[i];
@@ -520,18 +734,33 @@ bool fs_remove_file_or_directory(FILE *disk, fs_directory_tree_node_t *dir_node)
             return false;
         }
     }
-    fat12_write_full_fat_table(disk);
+    fat12_flush_fat_table(disk);
 
     // Now remove the entry from the parent directory
+    if (has_location && _fs_entry_matches(disk, owner.dirent, &dir_node->metadata)) {
+        fat12_file_subdir_s deleted = fat12_deleted_entry(dir_node->metadata);
+        if (!fat12_write_directory(disk, owner.dirent.cluster, owner.dirent.idx, deleted)) {
+            fprintf(stderr, "Erro ao remover a entrada do diretorio: %s\n", dir_node->metadata.filename);
+            arrfree(cluster_list);
+            return false;
+        }
+        if (owner.dirent.cluster == 0) {
+            printf("Entrada removida do diretorio raiz: %s\n", dir_node->metadata.filename);
+        }
+        arrfree(cluster_list);
+        return true;
+    }
+
+    // Not in the map (no clusters, or the map is not built): scan the parent directory
     // if the parent is NULL, we are in the root directory
     if (dir_node->parent->parent == NULL) {
         for (int i = 0; i < FAT12_ROOT_DIRECTORY_ENTRIES; i++) {
-            fat12_file_subdir_s dir_entry = fat12_read_directory_entry(disk, i);
+            fat12_file_subdir_s dir_entry = *fat12_view_directory_entry(disk, i);
 
             if (dir_entry.first_cluster == dir_node->metadata.first_cluster &&
                 (strcmp(dir_entry.filename, dir_node->metadata.filename) == 0)) {
                 // Found the entry, remove it
-                if (!fat12_write_directory(disk, 0, i, (fat12_file_subdir_s){0})) {
+                if (!fat12_write_directory(disk, 0, i, fat12_deleted_entry(dir_entry))) {
                     fprintf(stderr, "Erro ao remover a entrada do diretorio raiz: %s\n", dir_node->metadata.filename);
                     arrfree(cluster_list);
                     return false;
@@ -554,12 +783,12 @@ bool fs_remove_file_or_directory(FILE *disk, fs_directory_tree_node_t *dir_node)
             for (int j = 0; j < FAT12_DIRECTORY_ENTRIES_PER_SECTOR; j++) {
                 // Read the directory entry from the data area
                 // We are reading from the parent directory's cluster chain
-                fat12_file_subdir_s dir_entry = fat12_read_directory_from_data_area(disk, cluster_chain[i], j);
+                fat12_file_subdir_s dir_entry = *fat12_view_directory_from_data_area(disk, cluster_chain[i], j);
 
                 if (dir_entry.first_cluster == dir_node->metadata.first_cluster &&
                     (strcmp(dir_entry.filename, dir_node->metadata.filename) == 0)) {
                     // Found the entry, remove it
-                    if (!fat12_write_directory(disk, cluster_chain[i], j, (fat12_file_subdir_s){0})) {
+                    if (!fat12_write_directory(disk, cluster_chain[i], j, fat12_deleted_entry(dir_entry))) {
                         fprintf(stderr, "Erro ao remover a entrada do diretorio: %s\n", dir_node->metadata.filename);
                         arrfree(cluster_list);
                         arrfree(cluster_chain);
@@ -575,4 +804,24 @@ bool fs_remove_file_or_directory(FILE *disk, fs_directory_tree_node_t *dir_node)
     // Free the memory
     arrfree(cluster_list);
     return true;
+}
+
+bool fs_remove_file_or_directory(disk_t *disk, fs_directory_tree_node_t *dir_node) {
+    // "." and ".." are aliases of a directory and its parent: removing through them would free the real
+    // directory's clusters while its own entry stays behind
+    if (dir_node->parent == NULL || dir_node->metadata.filename[0] == '.') {
+        fprintf(stderr, "O diretorio raiz, '.' e '..' nao podem ser removidos\n");
+        return false;
+    }
+
+    // Every FAT and directory change of the subtree goes out in one commit
+    fs_begin_transaction();
+    if (!_fs_remove_node(disk, dir_node)) {
+        fs_abort_transaction(disk);
+        return false;
+    }
+    if (!fs_commit_transaction(disk)) return false;
+
+    _fs_forget_node(dir_node);
+    return true;
 }
\ No newline at end of file
@@ -0,0 +1,156 @@
+#include "flat_tree.h"
+
+#include "stb_ds.h"
+
+// All columns come from one allocation, widest fields first so each column stays aligned
+static bool _ft_allocate(ft_tree_t *flat, uint32_t count) {
+    size_t n = count;
+    size_t bytes = n * (4 * sizeof(uint32_t) + sizeof(uint16_t) + sizeof(fs_fat_compatible_filename_t) + 2);
+    uint8_t *memory = malloc(bytes);
+    if (memory == NULL) {
+        perror("malloc flat tree");
+        return false;
+    }
+
+    flat->count = count;
+    flat->sizes = (uint32_t *)memory;
+    flat->parents = flat->sizes + n;
+    flat->first_children = flat->parents + n;
+    flat->child_counts = flat->first_children + n;
+    flat->first_clusters = (uint16_t *)(flat->child_counts + n);
+    flat->names = (fs_fat_compatible_filename_t *)(flat->first_clusters + n);
+    flat->attributes = (uint8_t *)(flat->names + n);
+    flat->depths = flat->attributes + n;
+    return true;
+}
+
+bool ft_build(ft_tree_t *flat, disk_t *disk, fs_directory_tree_node_t *root) {
+    assert(flat != NULL);
+    assert(root != NULL);
+
+    memset(flat, 0, sizeof(*flat));
+    if (!fs_load_subtree(disk, root)) {
+        fprintf(stderr, "Failed to load the directory tree\n");
+        return false;
+    }
+
+    // Breadth-first order: the children of each node are appended together, which makes their indices contiguous
+    fs_directory_tree_node_t **order = NULL;
+    arrpush(order, root);
+    for (size_t i = 0; i < (size_t)arrlen(order); i++) {
+        for (size_t c = 0; c < order[i]->children_count; c++) {
+            arrpush(order, order[i]->children[c]);
+        }
+    }
+
+    if (!_ft_allocate(flat, (uint32_t)arrlen(order))) {
+        arrfree(order);
+        return false;
+    }
+
+    uint32_t next_child = 1;
+    flat->parents[0] = FT_NONE;
+    for (uint32_t i = 0; i < flat->count; i++) {
+        const fs_directory_tree_node_t *node = order[i];
+        memcpy(flat->names[i].file, node->metadata.filename, FAT12_FILE_NAME_LENGTH);
+        memcpy(flat->names[i].extension, node->metadata.extension, FAT12_FILE_EXTENSION_LENGTH);
+        flat->attributes[i] = node->type == FS_DIRECTORY_TYPE_SUBDIR ? node->metadata.attributes | FAT12_ATTR_DIRECTORY
+                                                                     : node->metadata.attributes;
+        flat->first_clusters[i] = node->metadata.first_cluster;
+        flat->sizes[i] = node->type == FS_DIRECTORY_TYPE_FILE ? node->metadata.file_size : 0;
+        flat->depths[i] = (uint8_t)node->depth;
+
+        flat->first_children[i] = next_child;
+        flat->child_counts[i] = (uint32_t)node->children_count;
+        for (uint32_t c = 0; c < flat->child_counts[i]; c++) {
+            flat->parents[next_child++] = i;
+        }
+    }
+
+    arrfree(order);
+    flat->generation = fs_get_tree_generation();
+    return true;
+}
+
+void ft_free(ft_tree_t *flat) {
+    free(flat->sizes);  // Start of the single allocation
+    memset(flat, 0, sizeof(*flat));
+}
+
+bool ft_is_dot_entry(const ft_tree_t *flat, uint32_t node) { return node != 0 && flat->names[node].file[0] == '.'; }
+
+bool ft_is_directory(const ft_tree_t *flat, uint32_t node) { return (flat->attributes[node] & FAT12_ATTR_DIRECTORY) != 0; }
+
+static void _ft_format_name(const ft_tree_t *flat, uint32_t node, char *name) {
+    fat12_file_subdir_s entry = {0};
+    memcpy(entry.filename, flat->names[node].file, FAT12_FILE_NAME_LENGTH);
+    memcpy(entry.extension, flat->names[node].extension, FAT12_FILE_EXTENSION_LENGTH);
+    f12h_format_filename(entry, name);
+}
+
+static void _ft_print_children(const ft_tree_t *flat, uint32_t node, const char *prefix) {
+    uint32_t first = flat->first_children[node];
+    uint32_t count = flat->child_counts[node];
+
+    for (uint32_t c = first; c < first + count; c++) {
+        bool is_last = c + 1 == first + count;
+        char name[FS_MAX_FILENAME_LENGTH];
+        _ft_format_name(flat, c, name);
+        printf("%s%s%s%s\n", prefix, is_last ? "`-- " : "|-- ", name, ft_is_directory(flat, c) ? "/" : "");
+
+        if (flat->child_counts[c] > 0) {
+            char new_prefix[256];
+            snprintf(new_prefix, sizeof(new_prefix), "%s%s", prefix, is_last ? "    " : "|   ");
+            _ft_print_children(flat, c, new_prefix);
+        }
+    }
+}
+
+void ft_print(const ft_tree_t *flat) {
+    if (flat->count == 0) return;
+
+    printf("/\n");
+    _ft_print_children(flat, 0, "");
+}
+
+void ft_subtree_sizes(const ft_tree_t *flat, uint64_t *totals) {
+    for (uint32_t i = 0; i < flat->count; i++) {
+        totals[i] = flat->sizes[i];
+    }
+
+    // Children always come after their parent, so walking backwards finishes every subtree before its parent
+    for (uint32_t i = flat->count; i-- > 1;) {
+        if (!ft_is_dot_entry(flat, i)) {
+            totals[flat->parents[i]] += totals[i];
+        }
+    }
+}
+
+uint32_t ft_find(const ft_tree_t *flat, const char *name, uint32_t **matches) {
+    fs_fat_compatible_filename_t packed;
+    if (!fs_pack_name(name, &packed)) return 0;
+
+    uint32_t found = 0;
+    for (uint32_t i = 1; i < flat->count; i++) {
+        if (memcmp(&flat->names[i], &packed, sizeof(packed)) == 0 && !ft_is_dot_entry(flat, i)) {
+            arrpush(*matches, i);
+            found++;
+        }
+    }
+    return found;
+}
+
+void ft_path(const ft_tree_t *flat, uint32_t node, char *buffer, size_t size) {
+    uint32_t ancestors[FS_MAX_DIRECTORY_DEPTH + 1];
+    size_t depth = 0;
+    for (uint32_t i = node; i != 0 && depth < FS_MAX_DIRECTORY_DEPTH + 1; i = flat->parents[i]) {
+        ancestors[depth++] = i;
+    }
+
+    size_t used = snprintf(buffer, size, "%s", depth == 0 ? "/" : "");
+    while (depth > 0 && used < size) {
+        char name[FS_MAX_FILENAME_LENGTH];
+        _ft_format_name(flat, ancestors[--depth], name);
+        used += snprintf(buffer + used, size - used, "/%s", name);
+    }
+}
@@ -0,0 +1,315 @@
+#include "io_batch.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block_device.h"
+#include "stb_ds.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define IOB_HAVE_IO_URING
+#endif
+#endif
+
+#ifdef IOB_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#define IOB_MAX_IOVECS 1024  // UIO_MAXIOV on Linux
+
+typedef enum {
+    IOB_OP_READ,
+    IOB_OP_WRITEV,
+} iob_op_e;
+
+typedef struct {
+    iob_op_e op;
+    int fd;
+    uint32_t first_sector;
+    uint32_t count;
+    void *buffer;         // IOB_OP_READ destination
+    size_t sector_array;  // IOB_OP_WRITEV: position of the first sector pointer in queued_sectors
+} iob_request_t;
+
+static iob_request_t *queue = NULL;            // stb_ds array
+static const uint8_t **queued_sectors = NULL;  // stb_ds array, sector pointers of every queued writev
+
+static bool _iob_run_sync(const iob_request_t *req) {
+    if (req->op == IOB_OP_READ) {
+        return bd_read_sectors(req->fd, req->buffer, req->first_sector, req->count);
+    }
+    return bd_writev_sectors(req->fd, queued_sectors + req->sector_array, req->first_sector, req->count);
+}
+
+#ifdef IOB_HAVE_IO_URING
+// Minimal io_uring driver on top of the raw system calls, so no liburing is needed.
+static struct {
+    int fd;
+    unsigned entries;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    struct iovec *iovecs;  // One iovec array per in-flight request, rebuilt on every submission
+} ring = {.fd = -1};
+
+static void _iob_ring_teardown(void) {
+    if (ring.sqes) munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_ring && ring.cq_ring != ring.sq_ring) munmap(ring.cq_ring, ring.cq_ring_size);
+    if (ring.sq_ring) munmap(ring.sq_ring, ring.sq_ring_size);
+    if (ring.fd >= 0) close(ring.fd);
+    arrfree(ring.iovecs);
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+}
+
+static bool _iob_ring_setup(unsigned queue_depth) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring.fd = (int)syscall(__NR_io_uring_setup, queue_depth, &params);
+    if (ring.fd < 0) return false;
+
+    ring.entries = params.sq_entries;
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring.cq_ring_size > ring.sq_ring_size) ring.sq_ring_size = ring.cq_ring_size;
+        ring.cq_ring_size = ring.sq_ring_size;
+    }
+
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED) {
+        ring.sq_ring = NULL;
+        _iob_ring_teardown();
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.cq_ring = ring.sq_ring;
+    } else {
+        ring.cq_ring = mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if (ring.cq_ring == MAP_FAILED) {
+            ring.cq_ring = NULL;
+            _iob_ring_teardown();
+            return false;
+        }
+    }
+
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        ring.sqes = NULL;
+        _iob_ring_teardown();
+        return false;
+    }
+
+    uint8_t *sq = ring.sq_ring;
+    uint8_t *cq = ring.cq_ring;
+    ring.sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring.cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+// Submits requests [first, first + n) as one ring full and reaps all their completions.
+// n must not exceed the ring size. Requests that fail or complete short are redone synchronously.
+// If the ring itself fails, it is torn down and every request without a completion is redone synchronously too:
+// the ring may still hold entries nobody will reap, so later batches go through the synchronous path.
+static bool _iob_ring_run(iob_request_t *requests, size_t n) {
+    // Every request becomes one READV/WRITEV sqe, reads use a single iovec over their buffer
+    arrfree(ring.iovecs);
+    size_t *iovec_start = malloc(n * sizeof(*iovec_start));
+    bool *completed_requests = calloc(n, sizeof(*completed_requests));
+    if (!iovec_start || !completed_requests) {
+        perror("malloc io_uring request state");
+        free(iovec_start);
+        free(completed_requests);
+        bool ok = true;
+        for (size_t i = 0; i < n; i++) {
+            ok = _iob_run_sync(&requests[i]) && ok;
+        }
+        return ok;
+    }
+    for (size_t i = 0; i < n; i++) {
+        iovec_start[i] = arrlen(ring.iovecs);
+        if (requests[i].op == IOB_OP_READ) {
+            struct iovec iov = {.iov_base = requests[i].buffer, .iov_len = (size_t)requests[i].count * SECTOR_SIZE};
+            arrpush(ring.iovecs, iov);
+        } else {
+            for (uint32_t s = 0; s < requests[i].count; s++) {
+                struct iovec iov = {.iov_base = (void *)queued_sectors[requests[i].sector_array + s], .iov_len = SECTOR_SIZE};
+                arrpush(ring.iovecs, iov);
+            }
+        }
+    }
+
+    unsigned tail = *ring.sq_tail;
+    for (size_t i = 0; i < n; i++) {
+        unsigned idx = tail & *ring.sq_mask;
+        struct io_uring_sqe *sqe = &ring.sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = requests[i].op == IOB_OP_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+        sqe->fd = requests[i].fd;
+        sqe->off = (uint64_t)requests[i].first_sector * SECTOR_SIZE;
+        sqe->addr = (uint64_t)(uintptr_t)&ring.iovecs[iovec_start[i]];
+        sqe->len = requests[i].op == IOB_OP_READ ? 1 : requests[i].count;
+        sqe->user_data = i;
+        ring.sq_array[idx] = idx;
+        tail++;
+    }
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+    free(iovec_start);
+
+    size_t completed = 0;
+    size_t submitted = 0;
+    bool ok = true;
+    while (completed < n) {
+        unsigned to_submit = (unsigned)(n - submitted);
+        int ret = (int)syscall(__NR_io_uring_enter, ring.fd, to_submit, (unsigned)(n - completed), IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            perror("io_uring_enter, usando I/O sincrono");
+            _iob_ring_teardown();  // Drops the unsubmitted entries and the completions not reaped yet
+
+            // Redoing a request that did reach the device rewrites, or reads again, the same sectors
+            for (size_t i = 0; i < n; i++) {
+                if (!completed_requests[i]) ok = _iob_run_sync(&requests[i]) && ok;
+            }
+            free(completed_requests);
+            return ok;
+        }
+        submitted += (size_t)ret;
+
+        unsigned head = *ring.cq_head;
+        unsigned cq_tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != cq_tail) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            iob_request_t *req = &requests[cqe->user_data];
+            if (cqe->res != (int32_t)(req->count * SECTOR_SIZE)) {
+                // Errors and short transfers are rare on image files, retry the whole request synchronously
+                ok = _iob_run_sync(req) && ok;
+            }
+            completed_requests[cqe->user_data] = true;
+            head++;
+            completed++;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    free(completed_requests);
+    return ok;
+}
+#endif
+
+void iob_init(bool use_io_uring, unsigned queue_depth) {
+    iob_destroy();
+
+#ifdef IOB_HAVE_IO_URING
+    if (use_io_uring && !_iob_ring_setup(queue_depth)) {
+        perror("io_uring indisponivel, usando I/O sincrono");
+    }
+#else
+    UNUSED(queue_depth);
+    if (use_io_uring) {
+        fprintf(stderr, "io_uring indisponivel nesta plataforma, usando I/O sincrono.\n");
+    }
+#endif
+}
+
+void iob_destroy(void) {
+#ifdef IOB_HAVE_IO_URING
+    if (ring.fd >= 0) _iob_ring_teardown();
+#endif
+    arrfree(queue);
+    arrfree(queued_sectors);
+}
+
+bool iob_uses_io_uring(void) {
+#ifdef IOB_HAVE_IO_URING
+    return ring.fd >= 0;
+#else
+    return false;
+#endif
+}
+
+void iob_queue_read(int fd, void *buffer, uint32_t first_sector, uint32_t count) {
+    assert(buffer != NULL);
+    iob_request_t req = {.op = IOB_OP_READ, .fd = fd, .first_sector = first_sector, .count = count, .buffer = buffer};
+    arrpush(queue, req);
+}
+
+void iob_queue_writev(int fd, const uint8_t *const *sectors, uint32_t first_sector, uint32_t count) {
+    assert(sectors != NULL);
+
+    // A single WRITEV takes at most IOB_MAX_IOVECS buffers, longer runs are split
+    while (count > 0) {
+        uint32_t chunk = count < IOB_MAX_IOVECS ? count : IOB_MAX_IOVECS;
+        iob_request_t req = {.op = IOB_OP_WRITEV, .fd = fd, .first_sector = first_sector, .count = chunk, .sector_array = arrlen(queued_sectors)};
+        for (uint32_t i = 0; i < chunk; i++) {
+            arrpush(queued_sectors, sectors[i]);
+        }
+        arrpush(queue, req);
+
+        sectors += chunk;
+        first_sector += chunk;
+        count -= chunk;
+    }
+}
+
+bool iob_submit_and_wait(void) {
+    bool ok = true;
+    size_t n = arrlen(queue);
+    size_t first = 0;  // Requests before first already went through the ring
+
+#ifdef IOB_HAVE_IO_URING
+    // The ring submits requests as they are, O_DIRECT descriptors need the aligned bounce path of the block layer
+    bool has_direct = false;
+    for (size_t i = 0; i < n && !has_direct; i++) {
+        has_direct = bd_is_direct(queue[i].fd);
+    }
+
+    if (ring.fd >= 0 && !has_direct) {
+        // A ring failure tears the ring down, whatever is left then runs synchronously below
+        while (first < n && ring.fd >= 0) {
+            size_t chunk = n - first < ring.entries ? n - first : ring.entries;
+            ok = _iob_ring_run(queue + first, chunk) && ok;
+            first += chunk;
+        }
+    }
+#endif
+
+    for (size_t i = first; i < n; i++) {
+        ok = _iob_run_sync(&queue[i]) && ok;
+    }
+
+    arrfree(queue);
+    arrfree(queued_sectors);
+    return ok;
+}
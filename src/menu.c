@@ -111,6 +111,17 @@ void init_menus(Menu* unmounted_menu, Menu* mounted_menu) {
     // Unmounted menu setup
     menu_add_item(unmounted_menu, "Montar \"fat12.img\"", app_mount_callback);
     menu_add_item(unmounted_menu, "Montar \"fat12subdir.img\"", app_mount_callback);
+
+    // Order must match app_io_mode_e
+    Menu* io_mode = menu_create("MODO DE I/O", NULL);
+    menu_add_item(io_mode, "pread/pwrite (padrao)", app_io_mode_callback);
+    menu_add_item(io_mode, "mmap", app_io_mode_callback);
+    menu_add_item(io_mode, "pread/pwrite + io_uring", app_io_mode_callback);
+    menu_add_item(io_mode, "pread/pwrite + O_DIRECT", app_io_mode_callback);
+    menu_add_item(io_mode, "memoria (descarta alteracoes)", app_io_mode_callback);
+    menu_add_item(io_mode, "Voltar", menu_back);
+    menu_add_submenu(unmounted_menu, "Modo de I/O", io_mode);
+
     menu_add_item(unmounted_menu, "Sair", quit_callback);
 
 #ifdef DEBUG
@@ -124,6 +135,10 @@ void init_menus(Menu* unmounted_menu, Menu* mounted_menu) {
     menu_add_item(mounted_menu, "ls-1 (Listar diretorio raiz)", app_ls1_callback);
     menu_add_item(mounted_menu, "ls   (Listar todos arquivos e diretorios)", app_ls_callback);
     menu_add_input(mounted_menu, "rm   (Remover arquivo ou diretorio) ", app_rm_callback);
+    menu_add_item(mounted_menu, "df   (Espaco livre em disco)", app_df_callback);
+    menu_add_item(mounted_menu, "du   (Uso por diretorio)", app_du_callback);
+    menu_add_input(mounted_menu, "find (Procurar por nome) ", app_find_callback);
+    menu_add_item(mounted_menu, "fsck (Verificar copias da FAT)", app_verify_fat_callback);
 
     setup_copy_flow(mounted_menu);
 
@@ -136,6 +151,7 @@ void init_menus(Menu* unmounted_menu, Menu* mounted_menu) {
     menu_add_item(quick_actions, "Voltar", menu_back);
 
     menu_add_submenu(mounted_menu, "Operacoes Rapidas", quick_actions);
+    menu_add_item(mounted_menu, "Estatisticas de I/O", app_io_stats_callback);
     menu_add_item(mounted_menu, "Desmontar Imagem", app_unmount_callback);
 }
 
@@ -0,0 +1,117 @@
+#include "readahead.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "fat12.h"
+
+static ra_stats_t stats = {0};
+
+// Clusters loaded into the window but never handed out count as wasted when the window is replaced,
+// including the ones a reader skipped over inside the window
+static size_t _ra_drop_window(ra_stream_t *stream) {
+    size_t unused = stream->buffer_count - (size_t)__builtin_popcountll(stream->buffer_handed);
+    stats.wasted += unused;
+    stream->buffer_count = 0;
+    stream->buffer_handed = 0;
+    return unused;
+}
+
+// Hints the clusters that the next window will cover, skipping any already hinted
+static void _ra_advise_ahead(ra_stream_t *stream, size_t from, uint32_t window) {
+    if (from < stream->advised_until) from = stream->advised_until;
+    if (from >= stream->length) return;
+
+    size_t count = stream->length - from < window ? stream->length - from : window;
+    if (fat12_advise_clusters(stream->disk, stream->chain + from, count) > 0) {
+        stats.advised += count;
+    }
+    stream->advised_until = from + count;
+}
+
+bool ra_open(ra_stream_t *stream, disk_t *disk, const uint16_t *chain, size_t length) {
+    assert(stream != NULL);
+    assert(disk != NULL);
+
+    *stream = (ra_stream_t){.disk = disk, .chain = chain, .length = length, .window = RA_MIN_WINDOW};
+    stream->buffer = malloc((size_t)RA_MAX_WINDOW * SECTOR_SIZE);
+    if (!stream->buffer) {
+        perror("malloc readahead window");
+        return false;
+    }
+
+    stats.streams++;
+    _ra_advise_ahead(stream, 0, stream->window);
+    return true;
+}
+
+const uint8_t *ra_read_cluster(ra_stream_t *stream, size_t index) {
+    assert(stream != NULL && stream->buffer != NULL);
+    assert(index < stream->length);
+
+    if (index >= stream->buffer_first && index < stream->buffer_first + stream->buffer_count) {
+        stats.hits++;
+        size_t position = index - stream->buffer_first;
+        stream->buffer_handed |= 1ULL << position;
+        stream->next = index + 1;
+        return stream->buffer + position * SECTOR_SIZE;
+    }
+
+    stats.misses++;
+
+    // Adapt the window before loading the next one
+    bool sequential = index == stream->next;
+    bool had_window = stream->buffer_count > 0;
+    size_t unused = _ra_drop_window(stream);
+    if (!sequential) {
+        stream->window = RA_MIN_WINDOW;
+    } else if (unused > 0) {
+        stream->window = stream->window / 2 < RA_MIN_WINDOW ? RA_MIN_WINDOW : stream->window / 2;
+    } else if (had_window) {
+        stream->window = stream->window * 2 > RA_MAX_WINDOW ? RA_MAX_WINDOW : stream->window * 2;
+    }
+
+    size_t count = stream->length - index < stream->window ? stream->length - index : stream->window;
+    if (!fat12_read_cluster_chain(stream->disk, stream->chain + index, count, stream->buffer)) {
+        return NULL;
+    }
+
+    stats.windows++;
+    stats.prefetched += count - 1;
+    stream->buffer_first = index;
+    stream->buffer_count = count;
+    stream->buffer_handed = 1;
+    stream->next = index + 1;
+
+    // Let the kernel fetch what the following window is likely to need while this one is consumed
+    if (sequential) {
+        uint32_t upcoming = stream->window * 2 > RA_MAX_WINDOW ? RA_MAX_WINDOW : stream->window * 2;
+        _ra_advise_ahead(stream, index + count, upcoming);
+    }
+
+    return stream->buffer;
+}
+
+void ra_close(ra_stream_t *stream) {
+    assert(stream != NULL);
+    _ra_drop_window(stream);
+    free(stream->buffer);
+    stream->buffer = NULL;
+}
+
+ra_stats_t ra_get_stats(void) { return stats; }
+
+void ra_print_stats(void) {
+    ra_stats_t s = ra_get_stats();
+    uint64_t requests = s.hits + s.misses;
+
+    printf("\n===== READAHEAD =====\n\n");
+    printf("Fluxos: %llu\n", (unsigned long long)s.streams);
+    printf("Acertos: %llu\n", (unsigned long long)s.hits);
+    printf("Faltas: %llu\n", (unsigned long long)s.misses);
+    printf("Janelas lidas: %llu\n", (unsigned long long)s.windows);
+    printf("Clusters antecipados: %llu (%llu descartados sem uso)\n",
+           (unsigned long long)s.prefetched, (unsigned long long)s.wasted);
+    printf("Clusters avisados ao kernel (WILLNEED): %llu\n", (unsigned long long)s.advised);
+    printf("Taxa de acerto: %.1f%%\n", requests ? (100.0 * s.hits) / requests : 0.0);
+}
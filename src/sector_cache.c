@@ -0,0 +1,371 @@
+#include "sector_cache.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block_device.h"
+#include "io_batch.h"
+#include "stb_ds.h"
+
+#define SC_NO_SLOT UINT32_MAX
+
+typedef struct {
+    uint32_t sector;  // Sector held by the slot, only meaningful while the slot is in use
+    uint32_t prev;    // Towards the most recently used end of the LRU list
+    uint32_t next;    // Towards the least recently used end of the LRU list
+    bool dirty;       // Modified in memory and not yet written to the device
+} sc_slot_t;
+
+static uint8_t *cache_data = NULL;  // capacity * SECTOR_SIZE bytes, slot i owns the i-th sector sized block
+static sc_slot_t *slots = NULL;
+static struct {
+    uint32_t key;    // Sector number
+    uint32_t value;  // Slot index
+} *sector_index = NULL;  // stb_ds hash map
+
+static uint32_t capacity = 0;
+static uint32_t used = 0;
+static uint32_t dirty_count = 0;
+static uint32_t dirty_threshold = 0;
+static uint32_t lru_head = SC_NO_SLOT;  // Most recently used
+static uint32_t lru_tail = SC_NO_SLOT;  // Least recently used, next to be evicted
+
+static sc_stats_t stats = {0};
+
+static void _sc_unlink(uint32_t slot) {
+    sc_slot_t *s = &slots[slot];
+    if (s->prev != SC_NO_SLOT) slots[s->prev].next = s->next;
+    if (s->next != SC_NO_SLOT) slots[s->next].prev = s->prev;
+    if (lru_head == slot) lru_head = s->next;
+    if (lru_tail == slot) lru_tail = s->prev;
+    s->prev = s->next = SC_NO_SLOT;
+}
+
+static void _sc_push_front(uint32_t slot) {
+    slots[slot].prev = SC_NO_SLOT;
+    slots[slot].next = lru_head;
+    if (lru_head != SC_NO_SLOT) slots[lru_head].prev = slot;
+    lru_head = slot;
+    if (lru_tail == SC_NO_SLOT) lru_tail = slot;
+}
+
+static uint8_t *_sc_slot_data(uint32_t slot) {
+    return cache_data + (size_t)slot * SECTOR_SIZE;
+}
+
+// Returns the slot caching `sector`, or SC_NO_SLOT.
+static uint32_t _sc_lookup(uint32_t sector) {
+    ptrdiff_t i = hmgeti(sector_index, sector);
+    return i < 0 ? SC_NO_SLOT : sector_index[i].value;
+}
+
+static int _sc_compare_slot_sectors(const void *a, const void *b) {
+    uint32_t sa = slots[*(const uint32_t *)a].sector;
+    uint32_t sb = slots[*(const uint32_t *)b].sector;
+    return (sa > sb) - (sa < sb);
+}
+
+// Picks a slot for a new sector: an unused one while there is room, otherwise the LRU victim.
+// A dirty victim triggers a full flush so its neighbours go out in the same coalesced writes.
+// Returns SC_NO_SLOT if that flush fails.
+static uint32_t _sc_claim_slot(int fd) {
+    if (used < capacity) {
+        return used++;
+    }
+
+    uint32_t victim = lru_tail;
+    if (slots[victim].dirty && !sc_flush(fd)) {
+        return SC_NO_SLOT;
+    }
+    _sc_unlink(victim);
+    (void)hmdel(sector_index, slots[victim].sector);
+    stats.evictions++;
+    return victim;
+}
+
+// Caches a clean copy of `sector` as the most recently used entry. Returns its slot or SC_NO_SLOT.
+static uint32_t _sc_insert_clean(int fd, uint32_t sector, const uint8_t *data) {
+    uint32_t slot = _sc_claim_slot(fd);
+    if (slot == SC_NO_SLOT) return SC_NO_SLOT;
+    memcpy(_sc_slot_data(slot), data, SECTOR_SIZE);
+    slots[slot].sector = sector;
+    slots[slot].dirty = false;
+    hmput(sector_index, sector, slot);
+    _sc_push_front(slot);
+    return slot;
+}
+
+bool sc_init(size_t budget_bytes) {
+    sc_destroy();
+    memset(&stats, 0, sizeof(stats));
+
+    capacity = budget_bytes / SECTOR_SIZE;
+    if (capacity == 0) return true;  // Cache disabled
+
+    cache_data = malloc((size_t)capacity * SECTOR_SIZE);
+    slots = malloc(capacity * sizeof(*slots));
+    if (!cache_data || !slots) {
+        perror("malloc sector cache");
+        sc_destroy();
+        return false;
+    }
+
+    dirty_threshold = capacity / 2;
+    stats.capacity = capacity;
+    return true;
+}
+
+void sc_destroy(void) {
+    if (dirty_count > 0) {
+        fprintf(stderr, "Sector cache destroyed with %u unflushed sectors.\n", dirty_count);
+    }
+    free(cache_data);
+    free(slots);
+    hmfree(sector_index);
+    cache_data = NULL;
+    slots = NULL;
+    capacity = used = dirty_count = 0;
+    lru_head = lru_tail = SC_NO_SLOT;
+}
+
+bool sc_is_enabled(void) { return capacity > 0; }
+
+const uint8_t *sc_get(int fd, uint32_t sector) {
+    assert(sc_is_enabled());
+
+    uint32_t slot = _sc_lookup(sector);
+    if (slot != SC_NO_SLOT) {
+        stats.hits++;
+        if (lru_head != slot) {
+            _sc_unlink(slot);
+            _sc_push_front(slot);
+        }
+        return _sc_slot_data(slot);
+    }
+
+    stats.misses++;
+
+    // A direct descriptor transfers a whole aligned block anyway, keep its other sectors too
+    uint32_t granularity = bd_transfer_granularity(fd);
+    if (granularity > 1 && granularity <= capacity) {
+        uint32_t first = sector - sector % granularity;
+        uint8_t *block = malloc((size_t)granularity * SECTOR_SIZE);
+        if (block && bd_read_sectors(fd, block, first, granularity)) {
+            for (uint32_t i = 0; i < granularity; i++) {
+                if (first + i == sector || _sc_lookup(first + i) != SC_NO_SLOT) continue;
+                if (_sc_insert_clean(fd, first + i, block + (size_t)i * SECTOR_SIZE) == SC_NO_SLOT) break;
+                stats.prefetched++;
+            }
+            // Inserted last so it is the most recently used of the block
+            slot = _sc_insert_clean(fd, sector, block + (size_t)(sector - first) * SECTOR_SIZE);
+            free(block);
+            return slot == SC_NO_SLOT ? NULL : _sc_slot_data(slot);
+        }
+        free(block);
+    }
+
+    // Read before claiming a slot so a failed read does not cost a cached sector
+    uint8_t data[SECTOR_SIZE];
+    if (!bd_read_sectors(fd, data, sector, 1)) {
+        return NULL;
+    }
+
+    slot = _sc_insert_clean(fd, sector, data);
+    return slot == SC_NO_SLOT ? NULL : _sc_slot_data(slot);
+}
+
+bool sc_read(int fd, void *buffer, uint32_t first_sector, uint32_t count) {
+    if (!sc_is_enabled()) {
+        return bd_read_sectors(fd, buffer, first_sector, count);
+    }
+
+    if (count == 1) {
+        const uint8_t *sector = sc_get(fd, first_sector);
+        if (sector == NULL) return false;
+        memcpy(buffer, sector, SECTOR_SIZE);
+        return true;
+    }
+
+    // Multi-sector transfers (FAT table, bulk data) read the device in one go,
+    // then cached sectors are laid over it since they may hold unflushed writes.
+    if (!bd_read_sectors(fd, buffer, first_sector, count)) return false;
+    sc_overlay_dirty(buffer, first_sector, count);
+    return true;
+}
+
+void sc_overlay_dirty(void *buffer, uint32_t first_sector, uint32_t count) {
+    if (dirty_count == 0) return;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t slot = _sc_lookup(first_sector + i);
+        if (slot != SC_NO_SLOT && slots[slot].dirty) {
+            memcpy((uint8_t *)buffer + (size_t)i * SECTOR_SIZE, _sc_slot_data(slot), SECTOR_SIZE);
+        }
+    }
+}
+
+static int _sc_compare_sectors(const void *a, const void *b) {
+    uint32_t sa = *(const uint32_t *)a;
+    uint32_t sb = *(const uint32_t *)b;
+    return (sa > sb) - (sa < sb);
+}
+
+bool sc_prefetch(int fd, const uint32_t *sectors, size_t n) {
+    if (!sc_is_enabled() || n == 0) return true;
+
+    // Keep only sectors that are not cached yet, sorted and unique, and never more than the cache can hold
+    uint32_t *missing = NULL;
+    for (size_t i = 0; i < n; i++) {
+        if (_sc_lookup(sectors[i]) == SC_NO_SLOT) arrpush(missing, sectors[i]);
+    }
+    if (arrlen(missing) == 0) {
+        arrfree(missing);
+        return true;
+    }
+    qsort(missing, arrlen(missing), sizeof(*missing), _sc_compare_sectors);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < (size_t)arrlen(missing) && unique < capacity; i++) {
+        if (unique == 0 || missing[unique - 1] != missing[i]) missing[unique++] = missing[i];
+    }
+
+    uint8_t *data = malloc(unique * SECTOR_SIZE);
+    if (!data) {
+        perror("malloc sector cache prefetch");
+        arrfree(missing);
+        return false;
+    }
+
+    // One queued read per run of adjacent sectors, all submitted together
+    for (size_t i = 0; i < unique;) {
+        size_t length = 1;
+        while (i + length < unique && missing[i + length] == missing[i] + length) length++;
+        iob_queue_read(fd, data + i * SECTOR_SIZE, missing[i], length);
+        i += length;
+    }
+
+    bool ok = iob_submit_and_wait();
+    for (size_t i = 0; i < unique && ok; i++) {
+        if (_sc_insert_clean(fd, missing[i], data + i * SECTOR_SIZE) == SC_NO_SLOT) {
+            ok = false;
+            break;
+        }
+        stats.prefetched++;
+    }
+
+    free(data);
+    arrfree(missing);
+    return ok;
+}
+
+bool sc_write(int fd, const void *buffer, uint32_t first_sector, uint32_t count) {
+    if (!sc_is_enabled()) {
+        return bd_write_sectors(fd, buffer, first_sector, count);
+    }
+
+    // Write-back: the sectors only land in the cache and are marked dirty
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t sector = first_sector + i;
+        uint32_t slot = _sc_lookup(sector);
+
+        if (slot == SC_NO_SLOT) {
+            slot = _sc_claim_slot(fd);
+            if (slot == SC_NO_SLOT) return false;
+            slots[slot].sector = sector;
+            slots[slot].dirty = false;
+            hmput(sector_index, sector, slot);
+            _sc_push_front(slot);
+        } else if (lru_head != slot) {
+            _sc_unlink(slot);
+            _sc_push_front(slot);
+        }
+
+        memcpy(_sc_slot_data(slot), (const uint8_t *)buffer + (size_t)i * SECTOR_SIZE, SECTOR_SIZE);
+        if (!slots[slot].dirty) {
+            slots[slot].dirty = true;
+            dirty_count++;
+        }
+    }
+
+    if (dirty_count >= dirty_threshold) {
+        return sc_flush(fd);
+    }
+    return true;
+}
+
+bool sc_flush(int fd) {
+    if (dirty_count == 0) return true;
+
+    // Sort the dirty slots by sector so adjacent sectors can be merged into a single write
+    uint32_t *dirty = malloc(dirty_count * sizeof(*dirty));
+    const uint8_t **run = malloc(dirty_count * sizeof(*run));
+    if (!dirty || !run) {
+        perror("malloc sector cache flush");
+        free(dirty);
+        free(run);
+        return false;
+    }
+
+    uint32_t n = 0;
+    for (uint32_t slot = 0; slot < used; slot++) {
+        if (slots[slot].dirty) dirty[n++] = slot;
+    }
+    qsort(dirty, n, sizeof(*dirty), _sc_compare_slot_sectors);
+
+    // Queue one vectored write per run, the batch engine copies the pointers so `run` can be reused
+    uint32_t runs = 0;
+    for (uint32_t i = 0; i < n;) {
+        uint32_t first_sector = slots[dirty[i]].sector;
+        uint32_t length = 0;
+        while (i + length < n && slots[dirty[i + length]].sector == first_sector + length) {
+            run[length] = _sc_slot_data(dirty[i + length]);
+            length++;
+        }
+        iob_queue_writev(fd, run, first_sector, length);
+        runs++;
+        i += length;
+    }
+
+    // On failure everything stays dirty, rewriting a sector that did make it is harmless
+    bool ok = iob_submit_and_wait();
+    if (ok) {
+        for (uint32_t i = 0; i < n; i++) {
+            slots[dirty[i]].dirty = false;
+        }
+        dirty_count = 0;
+        stats.flushed_runs += runs;
+        stats.flushed_sectors += n;
+    }
+
+    stats.flushes++;
+    free(dirty);
+    free(run);
+    return ok;
+}
+
+sc_stats_t sc_get_stats(void) {
+    sc_stats_t current = stats;
+    current.capacity = capacity;
+    current.used = used;
+    current.dirty = dirty_count;
+    return current;
+}
+
+void sc_print_stats(void) {
+    sc_stats_t s = sc_get_stats();
+    uint64_t requests = s.hits + s.misses;
+
+    printf("\n===== CACHE DE SETORES =====\n\n");
+    printf("Capacidade: %zu setores (%zu bytes)\n", s.capacity, s.capacity * SECTOR_SIZE);
+    printf("Em uso: %zu setores\n", s.used);
+    printf("Acertos: %llu\n", (unsigned long long)s.hits);
+    printf("Faltas: %llu\n", (unsigned long long)s.misses);
+    printf("Despejos: %llu\n", (unsigned long long)s.evictions);
+    printf("Pre-carregados: %llu\n", (unsigned long long)s.prefetched);
+    printf("Setores sujos: %zu\n", s.dirty);
+    printf("Descargas: %llu (%llu setores em %llu escritas)\n",
+           (unsigned long long)s.flushes, (unsigned long long)s.flushed_sectors, (unsigned long long)s.flushed_runs);
+    printf("Taxa de acerto: %.1f%%\n", requests ? (100.0 * s.hits) / requests : 0.0);
+}